@@ -0,0 +1,36 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <fmt/format.h>
+#include <limits>
+#include <string_view>
+
+namespace bench {
+
+struct Timing {
+    double best {};
+    double mean {};
+};
+
+// Runs `function` `iterations` times and returns the best and mean wall time in seconds.
+template<class Function>
+Timing measure(unsigned iterations, Function function)
+{
+    Timing timing { .best = std::numeric_limits<double>::infinity() };
+    for (unsigned s = 0; s < iterations; s++) {
+        auto start = std::chrono::steady_clock::now();
+        function();
+        auto time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        timing.best = std::min(timing.best, time);
+        timing.mean += time / iterations;
+    }
+    return timing;
+}
+
+inline void print_result(std::string_view name, Timing timing, std::string_view details)
+{
+    fmt::print("{:<32} best {:9.3f} ms  mean {:9.3f} ms  {}\n", name, timing.best * 1000, timing.mean * 1000, details);
+}
+
+}
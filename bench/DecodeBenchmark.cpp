@@ -0,0 +1,215 @@
+// Measures how fast MIDI files are decoded from a memory mapping, against reading the same file
+// byte by byte through std::istream, which is how the parser that it replaced read files. Both
+// tokenize all events on one thread. Loading the whole file with MIDIFileInput (which also merges
+// tracks into the timeline and builds keyframes) is measured with one and with all threads.
+//
+// Usage: midiplayer-bench-decode <file.mid> [iterations]
+
+#include "Benchmark.h"
+
+#include "MIDIFile.h"
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fmt/format.h>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <thread>
+
+namespace {
+
+// Reads a track chunk one byte at a time, keeping track of how much of it is left.
+class ChunkReader {
+public:
+    ChunkReader(std::istream& stream, size_t length)
+        : m_stream(stream)
+        , m_remaining(length)
+    {
+    }
+
+    bool eof() const { return m_remaining == 0; }
+
+    std::optional<uint8_t> read_u8()
+    {
+        if (m_remaining == 0)
+            return {};
+        auto byte = m_stream.get();
+        if (byte == EOF)
+            return {};
+        m_remaining--;
+        return byte;
+    }
+
+    std::optional<uint32_t> read_variable_length_quantity()
+    {
+        uint32_t value = 0;
+        for (size_t s = 0; s < 4; s++) {
+            auto byte = read_u8();
+            if (!byte)
+                return {};
+            value = (value << 7) | (*byte & 0x7f);
+            if (!(*byte & 0x80))
+                return value;
+        }
+        return {};
+    }
+
+    bool read_bytes(std::string& data, size_t length)
+    {
+        if (length > m_remaining)
+            return false;
+        data.resize(length);
+        m_stream.read(data.data(), length);
+        m_remaining -= length;
+        return m_stream.good();
+    }
+
+private:
+    std::istream& m_stream;
+    size_t m_remaining {};
+};
+
+std::optional<uint32_t> read_u32_big_endian(std::istream& stream)
+{
+    uint8_t bytes[4];
+    if (!stream.read(reinterpret_cast<char*>(bytes), 4))
+        return {};
+    return (bytes[0] << 24) | (bytes[1] << 16) | (bytes[2] << 8) | bytes[3];
+}
+
+// Tokenizes all events, keeping only the data of meta events, so this is a lower bound of what
+// an istream based parser costs. Returns the number of events, or nothing if the file is malformed.
+std::optional<size_t> read_events_from_stream(std::istream& stream)
+{
+    size_t event_count = 0;
+    std::string data;
+    while (stream.peek() != EOF) {
+        auto type = read_u32_big_endian(stream);
+        auto length = read_u32_big_endian(stream);
+        if (!type || !length)
+            return {};
+        // "MTrk"
+        if (*type != 0x4d54726b) {
+            stream.ignore(*length);
+            continue;
+        }
+        ChunkReader reader { stream, *length };
+        uint8_t running_status = 0;
+        while (!reader.eof()) {
+            if (!reader.read_variable_length_quantity())
+                return {};
+            auto status = reader.read_u8();
+            if (!status)
+                return {};
+            // With running status, the first data byte was just read.
+            size_t data_bytes_read = 0;
+            if (*status < 0x80) {
+                status = running_status;
+                data_bytes_read = 1;
+            } else if (*status < 0xf0) {
+                running_status = *status;
+            }
+
+            if (*status == 0xff) {
+                auto meta_type = reader.read_u8();
+                auto data_length = reader.read_variable_length_quantity();
+                if (!meta_type || !data_length || !reader.read_bytes(data, *data_length))
+                    return {};
+            } else if (*status == 0xf0 || *status == 0xf7) {
+                auto data_length = reader.read_variable_length_quantity();
+                if (!data_length || !reader.read_bytes(data, *data_length))
+                    return {};
+            } else if (*status & 0x80) {
+                size_t data_bytes = (*status & 0xf0) == 0xc0 || (*status & 0xf0) == 0xd0 ? 1 : 2;
+                for (; data_bytes_read < data_bytes; data_bytes_read++) {
+                    if (!reader.read_u8())
+                        return {};
+                }
+            } else {
+                return {};
+            }
+            event_count++;
+        }
+    }
+    return event_count;
+}
+
+class DecoderBenchmark : public MIDIFileInput {
+public:
+    // Decodes all events with TrackDecoder, without storing them. Returns the number of events,
+    // or nothing if the file is malformed.
+    static std::optional<size_t> decode_events(std::span<uint8_t const> data)
+    {
+        DecoderBenchmark input;
+        std::vector<TrackChunk> track_chunks;
+        if (!input.read_chunks(data, track_chunks))
+            return {};
+        EventPayloads payloads;
+        size_t event_count = 0;
+        for (auto const& chunk : track_chunks) {
+            TrackDecoder decoder { data, chunk };
+            while (!decoder.eof()) {
+                if (!decoder.read_event(payloads))
+                    return {};
+                event_count++;
+            }
+        }
+        return event_count;
+    }
+};
+
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2) {
+        fmt::print(stderr, "Usage: {} <file.mid> [iterations]\n", argv[0]);
+        return 1;
+    }
+    std::string path = argv[1];
+    unsigned iterations = argc > 2 ? std::max(1, atoi(argv[2])) : 5;
+
+    auto mapped_file = MappedFile::map(path);
+    if (mapped_file.is_error()) {
+        fmt::print(stderr, "Failed to open file: {}\n", mapped_file.release_error());
+        return 1;
+    }
+    auto size = mapped_file.value().size();
+    auto throughput = [&](bench::Timing timing, size_t event_count) {
+        return fmt::format("{:8.1f} MB/s  {:6.1f} M events/s", size / timing.best / 1e6, event_count / timing.best / 1e6);
+    };
+
+    size_t stream_event_count = 0;
+    auto stream_timing = bench::measure(iterations, [&] {
+        std::ifstream stream { path, std::ios::binary };
+        stream.ignore(14); // Header chunk
+        stream_event_count = read_events_from_stream(stream).value_or(0);
+    });
+    if (stream_event_count == 0) {
+        fmt::print(stderr, "Failed to read MIDI\n");
+        return 1;
+    }
+    fmt::print("{}: {} bytes, {} events, {} iterations\n", path, size, stream_event_count, iterations);
+    bench::print_result("istream (tokenize only)", stream_timing, throughput(stream_timing, stream_event_count));
+
+    size_t decoder_event_count = 0;
+    auto decoder_timing = bench::measure(iterations, [&] {
+        decoder_event_count = DecoderBenchmark::decode_events(mapped_file.value().data()).value_or(0);
+    });
+    bench::print_result("mmap (tokenize only)", decoder_timing, throughput(decoder_timing, decoder_event_count));
+
+    auto thread_count = std::max(1u, std::thread::hardware_concurrency());
+    for (auto threads : { 1u, thread_count }) {
+        size_t event_count = 0;
+        auto timing = bench::measure(iterations, [&] {
+            MIDIFileInput input { mapped_file.value().data(), threads };
+            event_count = input.is_valid() ? input.timeline().size() : 0;
+        });
+        bench::print_result(fmt::format("MIDIFileInput ({} threads)", threads), timing, throughput(timing, event_count));
+        if (threads == thread_count)
+            break;
+    }
+    return 0;
+}
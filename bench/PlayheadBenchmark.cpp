@@ -0,0 +1,87 @@
+// Measures the steady-state cost of moving the playhead by one frame when many events become
+// due in every frame: EventTimeline::Cursor against searching the range between the previous
+// and the current tick of the timeline in every frame, and against collecting that range from
+// every track and sorting it, which is how events were played before tracks were merged.
+//
+// Usage: midiplayer-bench-playhead [events per frame] [frames]
+
+#include "Benchmark.h"
+
+#include "EventTimeline.h"
+#include "Track.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fmt/format.h>
+
+int main(int argc, char* argv[])
+{
+    size_t events_per_frame = argc > 1 ? std::max(1, atoi(argv[1])) : 10240;
+    size_t frame_count = argc > 2 ? std::max(1, atoi(argv[2])) : 1000;
+
+    // Every tick is a frame here, events of 64 tracks interleaved as after merging.
+    constexpr size_t TrackCount = 64;
+    std::vector<Track> tracks(TrackCount);
+    std::vector<Event> events;
+    std::vector<EventTimeline::TrackIndex> track_indices;
+    events.reserve(events_per_frame * frame_count);
+    track_indices.reserve(events_per_frame * frame_count);
+    for (size_t tick = 0; tick < frame_count; tick++) {
+        for (size_t s = 0; s < events_per_frame; s++) {
+            auto event = Event::note(s % 2 == 0, s % 16, s % 128, 100);
+            event.set_tick(tick);
+            tracks[s % TrackCount].add_event(event);
+            events.push_back(event);
+            track_indices.push_back(s % TrackCount);
+        }
+    }
+    EventTimeline timeline { std::move(events), std::move(track_indices) };
+    fmt::print("{} events, {} per frame, {} frames\n", timeline.size(), events_per_frame, frame_count);
+
+    // Touch every event like playing does. The checksum is printed so that nothing is optimized away.
+    size_t checksum = 0;
+    auto play = [&](std::span<Event const> events) {
+        for (auto const& event : events)
+            checksum += event.velocity();
+        return events.size();
+    };
+    auto per_frame = [&](bench::Timing timing, size_t played_events) {
+        return fmt::format("{:8.2f} us/frame  {} events played", timing.best * 1e6 / frame_count, played_events);
+    };
+
+    size_t played_events = 0;
+    auto cursor_timing = bench::measure(5, [&] {
+        EventTimeline::Cursor cursor;
+        size_t event_count = 0;
+        for (size_t tick = 1; tick <= frame_count; tick++)
+            event_count += play(cursor.advance_to(timeline, tick));
+        played_events = event_count;
+    });
+    bench::print_result("cursor", cursor_timing, per_frame(cursor_timing, played_events));
+
+    auto search_timing = bench::measure(5, [&] {
+        size_t event_count = 0;
+        for (size_t tick = 1; tick <= frame_count; tick++)
+            event_count += play(timeline.events_in_range(tick - 1, tick));
+        played_events = event_count;
+    });
+    bench::print_result("search range every frame", search_timing, per_frame(search_timing, played_events));
+
+    auto per_track_timing = bench::measure(5, [&] {
+        size_t event_count = 0;
+        for (size_t tick = 1; tick <= frame_count; tick++) {
+            std::vector<Event> frame_events;
+            for (auto const& track : tracks) {
+                auto begin = std::ranges::lower_bound(track.events(), tick - 1, {}, &Event::tick);
+                auto end = std::ranges::lower_bound(begin, track.events().end(), tick, {}, &Event::tick);
+                frame_events.insert(frame_events.end(), begin, end);
+            }
+            std::ranges::stable_sort(frame_events, {}, &Event::tick);
+            event_count += play(frame_events);
+        }
+        played_events = event_count;
+    });
+    bench::print_result("per-track ranges, sorted", per_track_timing, per_frame(per_track_timing, played_events));
+    fmt::print("checksum {}\n", checksum);
+    return 0;
+}
@@ -7,4 +7,4 @@ if [ ! -e "$1" ]; then
     echo "Input file doesn't exist"
     exit
 fi
-build/midiplayer -o play "$1" | ffmpeg -f rawvideo -pix_fmt rgba -s:v 1920x1080 -r 60 -i pipe: "$2"
+build/midiplayer --encode "$2" play "$1"
@@ -1,38 +1,39 @@
 #version 120
 
+// Colors of transition units, 128 keys x 16 channels
+uniform sampler2D uTransitionColors;
+
 varying vec4 vColor;
-uniform vec2 uKeySize;
-uniform vec2 uKeyPos;
-uniform bool uIsBlack;
+varying vec2 vKeyOffset;
+varying vec2 vKeyHalfSize;
+
+vec4 color;
 
 const float BorderRadius = 8.0;
 const float BloomRadius = 10.0;
 const float AntialiasRadius = 1.0;
 
-float borderRadius() {
-    return min(min(BorderRadius, uKeySize.x / 2.0), uKeySize.y / 2.0);
+// See tile_vertex_color() in TileWorld.cpp
+vec4 tileColor() {
+    if (vColor.a < 0.5 / 255.0 && vColor.b > 254.5 / 255.0) {
+        vec2 unit = floor(vColor.rg * 255.0 + 0.5);
+        return texture2D(uTransitionColors, (unit + 0.5) / vec2(128.0, 16.0));
+    }
+    return vColor;
 }
 
-bool isCorner()
-{
-    float br = borderRadius();
-    bool is_x_corner = gl_FragCoord.x < uKeyPos.x + br || gl_FragCoord.x > uKeyPos.x + uKeySize.x - br;
-    bool is_y_corner = gl_FragCoord.y < uKeyPos.y + br || gl_FragCoord.y > uKeyPos.y + uKeySize.y - br;
-    return is_x_corner && is_y_corner;
+float borderRadius() {
+    return min(min(BorderRadius, vKeyHalfSize.x), vKeyHalfSize.y);
 }
 
 float distanceFromEdge() {
     float br = borderRadius();
-    bool is_left = gl_FragCoord.x < uKeyPos.x + br;
-    bool is_top = gl_FragCoord.y < uKeyPos.y + br;
-    bool is_right = gl_FragCoord.x > uKeyPos.x + uKeySize.x - br;
-    bool is_bottom = gl_FragCoord.y > uKeyPos.y + uKeySize.y - br;
-    float x = is_left ? gl_FragCoord.x - (uKeyPos.x + br) : (is_right ? gl_FragCoord.x - (uKeyPos.x + uKeySize.x - br) : 0);
-    float y = is_top ? gl_FragCoord.y - (uKeyPos.y + br) : (is_bottom ? gl_FragCoord.y - (uKeyPos.y + uKeySize.y - br) : 0);
-    if (x == 0 && y == 0) {
+    // Distance from the key shrunk by the border radius, which is 0 inside of it
+    vec2 outside = max(abs(vKeyOffset) - (vKeyHalfSize - br), 0.0);
+    if (outside.x == 0.0 && outside.y == 0.0) {
         return -1.0;
     }
-    return sqrt(x*x+y*y);
+    return length(outside);
 }
 
 float lightness(vec4 color) {
@@ -41,10 +42,10 @@ float lightness(vec4 color) {
 
 vec4 illumination(float r) {
     float br = borderRadius();
-    float sideFactor = (1 - (gl_FragCoord.x - uKeyPos.x) / uKeySize.x);
-    float illumination = lightness(vColor) * 0.25 * sideFactor;
+    float sideFactor = 0.5 - vKeyOffset.x / (2.0 * vKeyHalfSize.x);
+    float illumination = lightness(color) * 0.25 * sideFactor;
     float rScaled = pow(r / br, 2);
-    return vColor + vec4(1,1,1,0) * (rScaled*illumination);
+    return color + vec4(1,1,1,0) * (rScaled*illumination);
 }
 
 vec4 bloom(float r) {
@@ -52,16 +53,17 @@ vec4 bloom(float r) {
     const float BloomStart = 0.4;
     float rScaled = (r - br) / BloomRadius;
     float blurFactor = BloomStart - rScaled * BloomStart;
-    return vec4(vColor.rgb, vColor.a * blurFactor);
+    return vec4(color.rgb, color.a * blurFactor);
 }
 
 void main()
 {
+    color = tileColor();
     float br = borderRadius();
     float r = distanceFromEdge();
     if (r < 0) {
         // Full color
-        gl_FragColor = vColor;
+        gl_FragColor = color;
     }
     else if (r < br) {
         // Illumination
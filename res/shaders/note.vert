@@ -1,9 +1,19 @@
 #version 110
 
+// Distance of the rounded key edge from the edge of the drawn quad, in pixels
+uniform vec2 uMargin;
+
 varying vec4 vColor;
+// Position relative to the key center, in pixels
+varying vec2 vKeyOffset;
+varying vec2 vKeyHalfSize;
 
 void main()
 {
     vColor = gl_Color;
+    // Texture coordinates are the offset of the quad corner from the key center. All
+    // corners of a key yield the same half size, so it stays constant over the key.
+    vKeyOffset = gl_MultiTexCoord0.xy;
+    vKeyHalfSize = max(abs(gl_MultiTexCoord0.xy) - uMargin, 0.0);
     gl_Position = gl_ModelViewProjectionMatrix * gl_Vertex;
 }
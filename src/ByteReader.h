@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <span>
+
+// Bounds-checked reader over an in-memory byte buffer (e.g. a mmapped file).
+// All multi-byte values are big endian, as everywhere in SMF.
+class ByteReader {
+public:
+    explicit ByteReader(std::span<uint8_t const> data)
+        : m_data(data)
+    {
+    }
+
+    size_t offset() const { return m_offset; }
+    size_t size() const { return m_data.size(); }
+    size_t remaining() const { return m_data.size() - m_offset; }
+    bool eof() const { return m_offset >= m_data.size(); }
+
+    std::optional<uint8_t> peek_u8() const
+    {
+        if (eof())
+            return {};
+        return m_data[m_offset];
+    }
+
+    std::optional<uint8_t> read_u8()
+    {
+        if (eof())
+            return {};
+        return m_data[m_offset++];
+    }
+
+    std::optional<uint16_t> read_u16_be()
+    {
+        if (remaining() < 2)
+            return {};
+        uint16_t value = (m_data[m_offset] << 8) | m_data[m_offset + 1];
+        m_offset += 2;
+        return value;
+    }
+
+    std::optional<uint32_t> read_u32_be()
+    {
+        if (remaining() < 4)
+            return {};
+        uint32_t value = (m_data[m_offset] << 24) | (m_data[m_offset + 1] << 16) | (m_data[m_offset + 2] << 8) | m_data[m_offset + 3];
+        m_offset += 4;
+        return value;
+    }
+
+    std::optional<std::span<uint8_t const>> read_bytes(size_t count)
+    {
+        if (remaining() < count)
+            return {};
+        auto bytes = m_data.subspan(m_offset, count);
+        m_offset += count;
+        return bytes;
+    }
+
+    bool skip(size_t count)
+    {
+        if (remaining() < count)
+            return false;
+        m_offset += count;
+        return true;
+    }
+
+    // 1.1 - Variable Length Quantity
+    // "The largest number which is allowed is 0FFFFFFF so that the variable-length
+    // representations must fit in 32 bits in a routine to write variable-length numbers."
+    std::optional<uint32_t> read_variable_length_quantity()
+    {
+        uint32_t value = 0;
+        for (int i = 0; i < 4; i++) {
+            if (eof())
+                return {};
+            uint8_t byte = m_data[m_offset++];
+            value = (value << 7) | (byte & 0x7f);
+            if (!(byte & 0x80))
+                return value;
+        }
+        return {};
+    }
+
+private:
+    std::span<uint8_t const> m_data;
+    size_t m_offset {};
+};
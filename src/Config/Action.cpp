@@ -17,6 +17,51 @@ void SetAction::execute(Reader& reader) const
     reader.pop_transition();
 }
 
+std::shared_ptr<AddEventAction> AddEventAction::create_from_event_name(std::string_view name)
+{
+    if (name == "Text")
+        return std::make_shared<AddEventAction>(Event::text(Event::TextType::TrackName, 0));
+    return nullptr;
+}
+
+NamedFormalParameters AddEventAction::formal_parameters() const
+{
+    switch (m_event.type()) {
+        case Event::Type::Text:
+            return {
+                { "type", PropertyFormalParameter(PropertyType::String, "type") },
+                { "text", PropertyFormalParameter(PropertyType::String, "text") },
+            };
+        default:
+            return {};
+    }
+}
+
+bool AddEventAction::read_from_parameters(NamedParameters const& params)
+{
+    switch (m_event.type()) {
+        case Event::Type::Text: {
+            auto type = params.find("type");
+            if (type != params.end()) {
+                if (type->second.as_string() != "track_name") {
+                    logger::error("The only supported Text event type is 'track_name'");
+                    return false;
+                }
+            }
+            auto text = params.find("text");
+            if (text == params.end()) {
+                logger::error("required argument: 'text'");
+                return false;
+            }
+            m_text = text->second.as_string();
+            m_event = Event::text(Event::TextType::TrackName, 0);
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
 void AddEventAction::execute(Reader& reader) const
 {
     // NOTE: This adds events directly to input, so that it will
@@ -26,17 +71,23 @@ void AddEventAction::execute(Reader& reader) const
         logger::warning("No MIDI input to add event to!");
         return;
     }
-    if (input->track_count() < 1) {
-        logger::warning("No track to add event to!");
-        return;
+    auto new_event = m_event;
+    if (new_event.type() == Event::Type::Text) {
+        // Actions run again after seeking back, so reuse the payload instead of adding a copy
+        // every time. It's checked because payloads are dropped when a streamed input restarts.
+        auto& payloads = input->payloads();
+        if (m_payload_input != input || m_payload_index >= payloads.size() || payloads.get(m_payload_index) != m_text) {
+            m_payload_input = input;
+            m_payload_index = payloads.add(m_text);
+        }
+        new_event = Event::text(new_event.text_type(), m_payload_index);
     }
-    auto new_event = m_event->clone();
 
     // NOTE: We need to offset tick by 1 because the event won't be executed
     //       if it is added in the current tick because events are updated
     //       before actions.
-    new_event->set_tick(reader.player().current_tick() + 1);
-    input->track(0).add_event(std::move(new_event));
+    new_event.set_tick(reader.player().current_tick() + 1);
+    input->timeline().add_event(new_event, 0);
 }
 
 }
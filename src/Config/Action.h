@@ -5,6 +5,8 @@
 #include "Statement.h"
 #include "Transition.h"
 
+class MIDIInput;
+
 namespace Config {
 
 class Statement;
@@ -33,15 +35,26 @@ private:
 
 class AddEventAction : public Action {
 public:
-    explicit AddEventAction(std::unique_ptr<Event> event)
-        : m_event(std::move(event))
+    explicit AddEventAction(Event event)
+        : m_event(event)
     {
     }
 
+    // Returns nullptr if there is no event with that name.
+    static std::shared_ptr<AddEventAction> create_from_event_name(std::string_view);
+
+    NamedFormalParameters formal_parameters() const;
+    bool read_from_parameters(NamedParameters const&);
+
     virtual void execute(Reader&) const override;
 
 private:
-    std::unique_ptr<Event> m_event;
+    Event m_event;
+    // Text of a Text event. It is added to input's payloads only when executed.
+    std::string m_text;
+    // Index of m_text in payloads of the input it was last added to.
+    mutable MIDIInput const* m_payload_input = nullptr;
+    mutable uint32_t m_payload_index = 0;
 };
 
 }
@@ -124,7 +124,7 @@ ParserErrorOr<NamedParameters> Parser::parse_named_parameters(NamedFormalParamet
 
 ParserErrorOr<SelectorList> Parser::parse_selector_list()
 {
-    SelectorList selectors;
+    std::vector<std::shared_ptr<Selector>> selectors;
     while (true) {
         auto maybe_left_bracket = peek_next_token();
         if (!maybe_left_bracket || maybe_left_bracket->type() != Token::Type::SquareBracketLeft)
@@ -132,7 +132,7 @@ ParserErrorOr<SelectorList> Parser::parse_selector_list()
 
         selectors.push_back(TRY(parse_selector()));
     }
-    return selectors;
+    return SelectorList { selectors };
 }
 
 ParserErrorOr<AttributeValue> Parser::parse_selector_attribute_value()
@@ -336,16 +336,16 @@ ParserErrorOr<std::shared_ptr<AddEventAction>> Parser::parse_add_event_action()
     auto name = get_next_token_of_type(Token::Type::Identifier);
     if (!name)
         return parser_error("expected event type name");
-    auto event = Event::create_event_from_name(name->value());
-    if (!event)
+    auto action = AddEventAction::create_from_event_name(name->value());
+    if (!action)
         return parser_error("invalid event name");
-    auto formal_parameters = event->formal_parameters();
+    auto formal_parameters = action->formal_parameters();
     auto parameters = TRY(parse_named_parameters(formal_parameters));
-    if (!event->read_from_parameters(parameters)) {
+    if (!action->read_from_parameters(parameters)) {
         // FIXME: More detailed error info
         return parser_error("failed to read parameters");
     }
-    return std::make_shared<AddEventAction>(std::move(event));
+    return action;
 }
 
 ParserErrorOr<std::unique_ptr<Statement>> Parser::parse_statement()
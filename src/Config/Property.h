@@ -1,6 +1,7 @@
 #pragma once
 
 #include "AttributeValue.h"
+#include "Selector.h"
 #include "Time.h"
 #include <SFML/Graphics.hpp>
 #include <cassert>
@@ -11,7 +12,6 @@
 namespace Config {
 
 class PropertyParameter;
-class Selector;
 
 enum class PropertyType {
     Invalid,
@@ -47,7 +47,6 @@ private:
     std::shared_ptr<MatchExpression> m_match_expression;
 };
 
-using SelectorList = std::vector<std::shared_ptr<Selector>>;
 using PropertyParameterBase = std::variant<int, float, std::string, sf::Color, SelectorList, Time>;
 
 class PropertyParameter : public PropertyParameterBase {
@@ -6,6 +6,8 @@
 
 #include <stack>
 
+class MIDIPlayer;
+
 namespace Config {
 
 class Reader {
@@ -11,7 +11,7 @@ using namespace std::literals;
 
 namespace Config {
 
-bool AttributeSelector::matches(NoteEvent::TransitionUnit transition_unit, Tile const* event) const
+bool AttributeSelector::matches(TransitionUnit transition_unit, Tile const* event) const
 {
     switch (m_attribute) {
         case Attribute::Channel:
@@ -32,4 +32,20 @@ bool AttributeSelector::matches(NoteEvent::TransitionUnit transition_unit, Tile
     abort();
 }
 
+SelectorList::SelectorList(std::vector<std::shared_ptr<Selector>> const& selectors)
+    : m_empty(selectors.empty())
+{
+    for (auto const& selector : selectors) {
+        for (uint8_t channel = 0; channel < 16; channel++) {
+            for (uint8_t key = 0; key < 128; key++) {
+                TransitionUnit transition_unit { key, channel };
+                if (selector->matches(transition_unit, nullptr))
+                    m_unit_mask.set(transition_unit.index());
+            }
+        }
+        if (selector->depends_on_tile())
+            m_tile_selectors.push_back(selector);
+    }
+}
+
 }
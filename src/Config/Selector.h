@@ -1,14 +1,16 @@
 #pragma once
 
+#include <algorithm>
+#include <bitset>
 #include <istream>
 #include <memory>
 #include <variant>
+#include <vector>
 
 #include "../TileWorld.hpp"
 #include "AttributeValue.h"
 
 class MIDIPlayer;
-class NoteEvent;
 
 namespace Config {
 
@@ -19,7 +21,9 @@ public:
     Selector& operator=(Selector const&) = delete;
     virtual ~Selector() = default;
 
-    virtual bool matches(NoteEvent::TransitionUnit, Tile const*) const = 0;
+    virtual bool matches(TransitionUnit, Tile const*) const = 0;
+    // Whether matches() may give different results for tiles of the same transition unit.
+    virtual bool depends_on_tile() const { return false; }
 
     static std::unique_ptr<Selector> read(std::istream&);
 };
@@ -40,11 +44,41 @@ public:
     {
     }
 
-    virtual bool matches(NoteEvent::TransitionUnit, Tile const*) const override;
+    virtual bool matches(TransitionUnit, Tile const*) const override;
+    virtual bool depends_on_tile() const override { return m_attribute == Attribute::Time; }
 
 private:
     Attribute m_attribute {};
     AttributeValue m_value;
 };
 
+// Selectors of a property, matching if any of them does. They are compiled when parsed:
+// transition units that match for all tiles are stored as a bitset, so that only selectors
+// that depend on the tile itself (e.g by time) are evaluated when matching.
+class SelectorList {
+public:
+    using UnitMask = std::bitset<TransitionUnit::Count>;
+
+    SelectorList() = default;
+    explicit SelectorList(std::vector<std::shared_ptr<Selector>> const& selectors);
+
+    bool empty() const { return m_empty; }
+    // Units that match for every tile, by TransitionUnit::index().
+    UnitMask const& unit_mask() const { return m_unit_mask; }
+    // Whether tiles of units that are not in unit_mask() may match too.
+    bool depends_on_tile() const { return !m_tile_selectors.empty(); }
+
+    bool matches(TransitionUnit transition_unit, Tile const* tile) const
+    {
+        if (m_unit_mask[transition_unit.index()])
+            return true;
+        return tile && std::ranges::any_of(m_tile_selectors, [&](auto const& selector) { return selector->matches(transition_unit, tile); });
+    }
+
+private:
+    UnitMask m_unit_mask;
+    std::vector<std::shared_ptr<Selector>> m_tile_selectors;
+    bool m_empty = true;
+};
+
 }
@@ -1,131 +1,157 @@
 #include "Event.h"
-#include "Config/Property.h"
-#include "Logger.h"
-#include "MIDIPlayer.h"
-#include "RoundedEdgeRectangleShape.hpp"
-#include "TileWorld.hpp"
 
-#include <cstddef>
-#include <optional>
-#include <random>
-#include <type_traits>
+#include <fmt/format.h>
 
-std::unique_ptr<Event> Event::create_event_from_name(std::string_view name)
+uint32_t EventPayloads::add(std::string_view data)
 {
-    if (name == "Text")
-        return std::make_unique<TextEvent>();
-    return nullptr;
+    std::lock_guard lock { m_mutex };
+    m_payloads.emplace_back(data);
+    return m_first_index + m_payloads.size() - 1;
 }
 
-void TextEvent::execute(MIDIPlayer& player)
+std::string_view EventPayloads::get(uint32_t index) const
 {
-    switch (m_type) {
-        case Type::TrackName:
-            player.display_label(MIDIPlayer::LabelType::TrackName, m_text, 180);
-            break;
-        case Type::Lyric:
-        case Type::Text:
-        case Type::Copyright:
-        case Type::Instrument:
-        case Type::Marker:
-        case Type::CuePoint:
-            // TODO
-            break;
-    }
+    std::lock_guard lock { m_mutex };
+    if (index < m_first_index || index - m_first_index >= m_payloads.size())
+        return {};
+    return m_payloads[index - m_first_index];
 }
 
-Config::NamedFormalParameters TextEvent::formal_parameters() const
+size_t EventPayloads::size() const
 {
-    return {
-        { "type", Config::PropertyFormalParameter(Config::PropertyType::String, "type") },
-        { "text", Config::PropertyFormalParameter(Config::PropertyType::String, "text") },
-    };
+    std::lock_guard lock { m_mutex };
+    return m_first_index + m_payloads.size();
 }
 
-bool TextEvent::read_from_parameters(Config::NamedParameters const& params)
+void EventPayloads::remove_before(uint32_t index)
 {
-    auto type = params.find("type");
-    if (type != params.end()) {
-        if (type->first != "track_name") {
-            logger::error("The only supported TextEvent type is 'track_name'");
-            return false;
-        }
-    }
-    auto text = params.find("text");
-    if (text == params.end()) {
-        logger::error("required argument: 'text'");
-        return false;
+    std::lock_guard lock { m_mutex };
+    while (m_first_index < index && !m_payloads.empty()) {
+        m_payloads.pop_front();
+        m_first_index++;
     }
-    m_text = text->second.as_string();
-    m_type = Type::TrackName;
-    return true;
 }
 
-void SetTempoEvent::execute(MIDIPlayer& player)
+void EventPayloads::clear()
 {
-    player.set_tempo(m_microseconds_per_quarter_note);
+    std::lock_guard lock { m_mutex };
+    m_payloads.clear();
+    m_first_index = 0;
+}
+
+void Event::dump(EventPayloads const& payloads) const
+{
+    switch (m_type) {
+        case Type::Invalid:
+            std::cerr << "Invalid Event " << std::hex << (int)m_data1 << std::dec << std::endl;
+            break;
+        case Type::EndOfTrack:
+            std::cerr << tick() << ": End Of Track Event" << std::endl;
+            break;
+        case Type::Text:
+            std::cerr << "Text Event " << static_cast<int>(m_data1) << ": " << payloads.get(m_value) << std::endl;
+            break;
+        case Type::SetTempo:
+            std::cerr << "Set Tempo Event " << m_value << std::endl;
+            break;
+        case Type::TimeSignature:
+            std::cerr << "Time Signature Event " << static_cast<int>(numerator()) << "/" << (1u << denominator()) << std::endl;
+            break;
+        case Type::NoteOn:
+        case Type::NoteOff:
+            std::cerr << tick() << ": Note " << (m_type == Type::NoteOn ? "On" : "Off") << " Event channel=" << (int)m_channel
+                      << ", key=" << (int)m_data1 << ", velocity=" << (int)m_data2 << std::endl;
+            break;
+        case Type::ControlChange:
+            if (m_data1 < 0x40) {
+                std::cerr << "Control Change Event channel=" << (int)m_channel << ", number=" << std::hex << (int)m_data1 << std::dec
+                          << "(" << (m_data1 & 0x20 ? "MSB" : "LSB") << "), value=" << (int)m_data2 << std::endl;
+            } else {
+                std::cerr << tick() << ": Control Change Event channel=" << (int)m_channel << ", number=" << std::hex << (int)m_data1 << std::dec << ", value=" << (int)m_data2 << std::endl;
+            }
+            break;
+        case Type::ProgramChange:
+            std::cerr << "Program Change Event channel=" << (int)m_channel << ", data=" << std::hex << (int)m_data1 << std::dec << std::endl;
+            break;
+    }
 }
 
-void NoteEvent::execute(MIDIPlayer& player)
+bool Event::is_serializable() const
 {
-    if (player.real_time()) {
-        player.tile_world().push_note_event(*this);
+    switch (m_type) {
+        case Type::EndOfTrack:
+        case Type::TimeSignature:
+        case Type::NoteOn:
+        case Type::NoteOff:
+        case Type::ControlChange:
+        case Type::ProgramChange:
+            return true;
+        case Type::Invalid:
+        case Type::Text:
+        // FIXME: Set Tempo glitches real MIDI devices.
+        case Type::SetTempo:
+            return false;
     }
-    player.set_sound_playing(m_key, m_velocity, m_type == Type::On ? true : false,
-        player.resolve_color(Tile { tick(), {}, transition_unit() }));
+    return false;
 }
 
-void ControlChangeEvent::execute(MIDIPlayer& player)
+void Event::serialize(std::ostream& stream) const
 {
-    switch (m_number) {
-        case Number::DamperPedal:
-            player.pedals().set_sustain(m_value > 0);
+    switch (m_type) {
+        case Type::EndOfTrack:
+            std::cerr << "Writing EndOfTrack" << std::endl;
+            stream.put(-1);   // Meta-event
+            stream.put(0x2f); // End Of Track
+            stream.put(0);    // size: vlq 1
             break;
-        case Number::Portamento:
+        case Type::TimeSignature:
+            std::cerr << "Writing TimeSignature" << std::endl;
+            stream.put(0xff); // Meta-event
+            stream.put(0x58); // Time Signature
+            stream.put(4);    // size: vlq 4
+            stream.put(numerator());
+            stream.put(denominator());
+            stream.put(clocks_per_metronome_click());
+            stream.put(_32s_in_quarter_note());
             break;
-        case Number::Sostenuto:
-            player.pedals().set_sostenuto(m_value > 0);
+        case Type::NoteOn:
+        case Type::NoteOff:
+            fmt::println("SERIALIZE NOTE {} EVENT FOR CHANNEL {} NOTE {}",
+                m_type == Type::NoteOn ? "ON" : "OFF", m_channel, m_data1);
+            stream.put((uint8_t)((m_type == Type::NoteOn ? 0x90 : 0x80) + m_channel));
+            stream.put(m_data1);
+            stream.put(m_data2);
             break;
-        case Number::SoftPedal:
-            player.pedals().set_soft(m_value > 0);
+        case Type::ControlChange:
+            stream.put((uint8_t)(0xb0 + m_channel)); // Control Change
+            stream.put(m_data1);                     // Number
+            stream.put(m_data2);
             break;
-        case Number::LegatoFootswitch:
-        case Number::Hold2:
-        case Number::SoundController1:
-        case Number::SoundController2:
-        case Number::SoundController3:
-        case Number::SoundController4:
-        case Number::SoundController5:
-        case Number::SoundController6:
-        case Number::SoundController7:
-        case Number::SoundController8:
-        case Number::SoundController9:
-        case Number::SoundController10:
-        case Number::GeneralPurposeController5:
-        case Number::GeneralPurposeController6:
-        case Number::GeneralPurposeController7:
-        case Number::GeneralPurposeController8:
-        case Number::PortamentoControl:
-        case Number::Effects1Depth:
-        case Number::Effects2Depth:
-        case Number::Effects3Depth:
-        case Number::Effects4Depth:
-        case Number::Effects5Depth:
-        case Number::DataEntryPlus1:
-        case Number::DataEntryMinus1:
-        case Number::NonRegisteredParameterNumberLSB:
-        case Number::NonRegisteredParameterNumberMSB:
-        case Number::RegisteredParameterNumberLSB:
-        case Number::RegisteredParameterNumberMSB:
-        case Number::AllSoundOff:
-        case Number::ResetAllControllers:
-        case Number::LocalControlOnOff:
-        case Number::AllNotesOff:
-        case Number::OmniModeOff:
-        case Number::OmniModeOn:
-        case Number::PolyModeOn:
-        case Number::PolyModeOnInclMono:
-        case Number::Count:
+        case Type::ProgramChange:
+            stream.put((uint8_t)(0xc0 + m_channel)); // Program Change
+            stream.put(m_data1);
             break;
+        case Type::Invalid:
+        case Type::Text:
+        case Type::SetTempo:
+            break;
+    }
+}
+
+bool Event::should_send_to_device() const
+{
+    switch (m_type) {
+        case Type::EndOfTrack:
+        case Type::Text:
+        case Type::TimeSignature:
+            return false;
+        case Type::Invalid:
+        case Type::SetTempo:
+        case Type::NoteOn:
+        case Type::NoteOff:
+        case Type::ControlChange:
+        case Type::ProgramChange:
+            return true;
     }
+    return false;
 }
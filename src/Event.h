@@ -1,79 +1,141 @@
 #pragma once
 
-#include "Config/Property.h"
 #include "MIDIKey.h"
 
-#include <SFML/Graphics.hpp>
-#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
 #include <iostream>
-#include <memory>
-#include <optional>
+#include <mutex>
+#include <string>
+#include <string_view>
 
-class MIDIPlayer;
-
-class Event {
-public:
-    virtual ~Event() = default;
-
-    void set_tick(size_t tick) { m_tick = tick; }
-    size_t tick() const { return m_tick; }
-
-    virtual void dump() const = 0;
-    virtual void execute(MIDIPlayer&) = 0;
-
-    virtual bool is_serializable() const { return false; }
-    virtual void serialize(std::ostream&) const { }
-
-    virtual bool should_send_to_device() const { return true; }
+using MIDIChannel = uint8_t;
 
-    virtual std::unique_ptr<Event> clone() const = 0;
-    virtual Config::NamedFormalParameters formal_parameters() const { return {}; }
-    virtual bool read_from_parameters(Config::NamedParameters const&) { return false; }
+struct TransitionUnit {
+    static constexpr size_t Count = 16 * 128;
 
-    static std::unique_ptr<Event> create_event_from_name(std::string_view);
+    MIDIKey key;
+    MIDIChannel channel;
 
-private:
-    size_t m_tick { 0 };
+    // Dense index of the unit, for tables over all channels and keys.
+    size_t index() const { return channel * 128 + key.code(); }
 };
 
-class EndOfTrackEvent : public Event {
-public:
-    virtual void dump() const override { std::cerr << tick() << ": End Of Track Event" << std::endl; }
-    virtual void execute(MIDIPlayer&) override { }
-
-    virtual bool is_serializable() const override { return true; }
-    virtual void serialize(std::ostream& stream) const override
+template<>
+struct std::hash<TransitionUnit> {
+    size_t operator()(TransitionUnit const& tu) const
     {
-        std::cerr << "Writing EndOfTrack" << std::endl;
-        stream.put(-1);   // Meta-event
-        stream.put(0x2f); // End Of Track
-        stream.put(0);    // size: vlq 1
+        return (static_cast<size_t>(tu.channel) << 8) | tu.key.code();
     }
+};
 
-    virtual bool should_send_to_device() const override { return false; }
+inline bool operator==(TransitionUnit const& l, TransitionUnit const& r)
+{
+    return l.channel == r.channel && l.key == r.key;
+}
 
-    virtual std::unique_ptr<Event> clone() const override { return std::make_unique<EndOfTrackEvent>(*this); }
+// Appendix 1.2 - Table of MIDI Controller Messages (Data Bytes)
+enum class ControlChangeNumber : uint8_t {
+    // 0x0 - 0x3f are MSB/LSB pairs of 14-bit controllers (bit 0x20 selects the LSB)
+    BankSelect = 0x0,
+    ModulationWheel,
+    BreathControl,
+    FootController = 0x4,
+    PortamentoTime,
+    DataEntry,
+    ChannelVolume,
+    Balance,
+    Pan = 0xa,
+    ExpressionController,
+    EffectControl1,
+    EffectControl2,
+    GeneralPurposeController1 = 0x10,
+    GeneralPurposeController2,
+    GeneralPurposeController3,
+    GeneralPurposeController4,
+    DamperPedal = 0x40,
+    Portamento,
+    Sostenuto,
+    SoftPedal,
+    LegatoFootswitch,
+    Hold2,
+    SoundController1,
+    SoundController2,
+    SoundController3,
+    SoundController4,
+    SoundController5,
+    SoundController6,
+    SoundController7,
+    SoundController8,
+    SoundController9,
+    SoundController10,
+    GeneralPurposeController5,
+    GeneralPurposeController6,
+    GeneralPurposeController7,
+    GeneralPurposeController8,
+    PortamentoControl,
+    Effects1Depth = 0x5b,
+    Effects2Depth,
+    Effects3Depth,
+    Effects4Depth,
+    Effects5Depth,
+    DataEntryPlus1,
+    DataEntryMinus1,
+    NonRegisteredParameterNumberLSB,
+    NonRegisteredParameterNumberMSB,
+    RegisteredParameterNumberLSB,
+    RegisteredParameterNumberMSB,
+    AllSoundOff = 0x78,
+    ResetAllControllers,
+    LocalControlOnOff,
+    AllNotesOff,
+    OmniModeOff,
+    OmniModeOn,
+    PolyModeOn,
+    PolyModeOnInclMono,
+    Count
 };
 
-class InvalidEvent : public Event {
+// Out-of-line storage for event data that doesn't fit into an Event (e.g text of meta events).
+// Tracks are decoded concurrently, so adding payloads is thread-safe.
+class EventPayloads {
 public:
-    InvalidEvent(uint8_t type)
-        : m_type(type)
-    {
-    }
-
-    virtual void dump() const override { std::cerr << "Invalid Event " << std::hex << (int)m_type << std::dec << std::endl; }
-    virtual void execute(MIDIPlayer&) override { }
-
-    virtual std::unique_ptr<Event> clone() const override { return std::make_unique<InvalidEvent>(*this); }
+    uint32_t add(std::string_view data);
+    // Empty for removed payloads.
+    std::string_view get(uint32_t index) const;
+    // Index that the next added payload gets. Removing payloads doesn't change it.
+    size_t size() const;
+    // Frees payloads with indices below `index`; the others keep their indices.
+    void remove_before(uint32_t index);
+    void clear();
 
 private:
-    uint8_t m_type;
+    mutable std::mutex m_mutex;
+    // NOTE: std::deque so that views stay valid when adding or removing payloads.
+    std::deque<std::string> m_payloads;
+    // Index of the first payload in m_payloads
+    uint32_t m_first_index = 0;
 };
 
-class TextEvent : public Event {
+// A single MIDI event, stored by value. Channel messages keep their data bytes, meta
+// events store their value inline (tempo, time signature) or as an index into EventPayloads.
+class Event {
 public:
-    enum class Type {
+    enum class Type : uint8_t {
+        Invalid,
+        EndOfTrack,
+        Text,
+        SetTempo,
+        TimeSignature,
+        NoteOn,
+        NoteOff,
+        ControlChange,
+        ProgramChange
+    };
+
+    enum class TextType : uint8_t {
         Text,
         Copyright,
         TrackName,
@@ -83,334 +145,72 @@ public:
         CuePoint
     };
 
-    TextEvent(Type type = {}, std::string const& text = {})
-        : m_type(type)
-        , m_text(text)
-    {
-    }
-
-    virtual void dump() const override { std::cerr << "Text Event " << static_cast<int>(m_type) << ": " << m_text << std::endl; }
-    virtual void execute(MIDIPlayer&) override;
-
-    virtual bool should_send_to_device() const override { return false; }
-
-    virtual std::unique_ptr<Event> clone() const override { return std::make_unique<TextEvent>(*this); }
-    virtual Config::NamedFormalParameters formal_parameters() const override;
-    virtual bool read_from_parameters(Config::NamedParameters const&) override;
-
-private:
-    Type m_type;
-    std::string m_text;
-};
+    Event() = default;
 
-class SetTempoEvent : public Event {
-public:
-    SetTempoEvent(uint32_t microseconds_per_quarter_note)
-        : m_microseconds_per_quarter_note(microseconds_per_quarter_note)
+    static Event invalid(uint8_t status) { return Event { Type::Invalid, 0, status, 0, 0 }; }
+    static Event end_of_track() { return Event { Type::EndOfTrack, 0, 0, 0, 0 }; }
+    static Event text(TextType type, uint32_t payload_index) { return Event { Type::Text, 0, static_cast<uint8_t>(type), 0, payload_index }; }
+    static Event set_tempo(uint32_t microseconds_per_quarter_note) { return Event { Type::SetTempo, 0, 0, 0, microseconds_per_quarter_note }; }
+    // `denominator` is a power of two exponent, as stored in the file: 2 represents a quarter-note, 3 an eighth-note
+    static Event time_signature(uint8_t numerator, uint8_t denominator, uint8_t clocks_per_metronome_click, uint8_t _32s_in_quarter_note)
     {
+        return Event { Type::TimeSignature, 0, 0, 0,
+            static_cast<uint32_t>(numerator | (denominator << 8) | (clocks_per_metronome_click << 16) | (_32s_in_quarter_note << 24)) };
     }
+    static Event note(bool on, MIDIChannel channel, MIDIKey key, uint8_t velocity) { return Event { on ? Type::NoteOn : Type::NoteOff, channel, key.code(), velocity, 0 }; }
+    static Event control_change(MIDIChannel channel, ControlChangeNumber number, uint8_t value) { return Event { Type::ControlChange, channel, static_cast<uint8_t>(number), value, 0 }; }
+    static Event program_change(MIDIChannel channel, uint8_t program) { return Event { Type::ProgramChange, channel, program, 0, 0 }; }
 
-    virtual void dump() const override { std::cerr << "Set Tempo Event " << m_microseconds_per_quarter_note << std::endl; }
-    virtual void execute(MIDIPlayer&) override;
-
-    virtual bool is_serializable() const override { return false; }
-    virtual void serialize(std::ostream& stream) const override
-    {
-        // FIXME: This glitches real MIDI devices.
-        /*std::cerr << "Writing SetTempo" << std::endl;
-        stream.put(-1);   // Meta-event
-        stream.put(0x51); // Set Tempo
-        stream.put(3);    // size: vlq 3
-        stream.put((m_microseconds_per_quarter_note >> 16) & 0xff);
-        stream.put((m_microseconds_per_quarter_note >> 8) & 0xff);
-        stream.put(m_microseconds_per_quarter_note & 0xff);*/
-    }
+    void set_tick(size_t tick) { m_tick = tick; }
+    size_t tick() const { return m_tick; }
+    Type type() const { return m_type; }
 
-    virtual std::unique_ptr<Event> clone() const override { return std::make_unique<SetTempoEvent>(*this); }
+    bool is_note() const { return m_type == Type::NoteOn || m_type == Type::NoteOff; }
 
-private:
-    uint32_t m_microseconds_per_quarter_note;
-};
+    // Channel messages
+    MIDIChannel channel() const { return m_channel; }
+    MIDIKey key() const { return m_data1; }
+    uint8_t velocity() const { return m_data2; }
+    TransitionUnit transition_unit() const { return { key(), m_channel }; }
+    ControlChangeNumber control_number() const { return static_cast<ControlChangeNumber>(m_data1); }
+    uint8_t control_value() const { return m_data2; }
+    uint8_t program() const { return m_data1; }
 
-class TimeSignatureEvent : public Event {
-public:
-    TimeSignatureEvent(unsigned numerator, unsigned denominator, uint8_t clocks_per_metronome_click, uint8_t _32s_in_quarter_note)
-        : m_numerator(numerator)
-        , m_denominator(denominator)
-        , m_clocks_per_metronome_click(clocks_per_metronome_click)
-        , m_32s_in_quarter_note(_32s_in_quarter_note)
-    {
-    }
+    // Meta events
+    TextType text_type() const { return static_cast<TextType>(m_data1); }
+    uint32_t payload_index() const { return m_value; }
+    uint32_t microseconds_per_quarter_note() const { return m_value; }
+    uint8_t numerator() const { return m_value & 0xff; }
+    uint8_t denominator() const { return (m_value >> 8) & 0xff; }
+    uint8_t clocks_per_metronome_click() const { return (m_value >> 16) & 0xff; }
+    uint8_t _32s_in_quarter_note() const { return m_value >> 24; }
 
-    virtual void dump() const override
-    {
-        std::cerr << "Time Signature Event " << static_cast<int>(m_numerator) << "/" << static_cast<int>(m_denominator) << std::endl;
-    }
-    virtual void execute(MIDIPlayer&) override
-    { /* TODO */
-    }
+    // Status byte of invalid events
+    uint8_t invalid_status() const { return m_data1; }
 
-    virtual bool is_serializable() const override { return true; }
-    virtual void serialize(std::ostream& stream) const override
-    {
-        std::cerr << "Writing TimeSignature" << std::endl;
-        stream.put(0xff); // Meta-event
-        stream.put(0x58); // Time Signature
-        stream.put(4);    // size: vlq 4
-        stream.put(m_numerator);
-        stream.put(std::countr_zero(m_denominator));
-        stream.put(m_clocks_per_metronome_click);
-        stream.put(m_32s_in_quarter_note);
-    }
+    void dump(EventPayloads const&) const;
 
-    virtual bool should_send_to_device() const override { return false; }
+    bool is_serializable() const;
+    void serialize(std::ostream&) const;
 
-    virtual std::unique_ptr<Event> clone() const override { return std::make_unique<TimeSignatureEvent>(*this); }
+    bool should_send_to_device() const;
 
 private:
-    unsigned m_numerator;
-    unsigned m_denominator;
-    uint8_t m_clocks_per_metronome_click;
-    uint8_t m_32s_in_quarter_note;
-};
-
-using MIDIChannel = uint8_t;
-
-class NoteEvent : public Event {
-public:
-    enum class Type {
-        On,
-        Off
-    };
-
-    struct TransitionUnit {
-        MIDIKey key;
-        MIDIChannel channel;
-    };
-
-    NoteEvent(Type type, MIDIChannel channel, MIDIKey key, uint8_t velocity)
+    Event(Type type, MIDIChannel channel, uint8_t data1, uint8_t data2, uint32_t value)
         : m_type(type)
         , m_channel(channel)
-        , m_key(key)
-        , m_velocity(velocity)
-    {
-    }
-
-    virtual void dump() const override
-    {
-        std::cerr << tick() << ": Note " << (m_type == Type::On ? "On" : "Off") << " Event channel=" << (int)m_channel
-                  << ", key=" << (int)m_key << ", velocity=" << (int)m_velocity << std::endl;
-    }
-
-    virtual void execute(MIDIPlayer&) override;
-
-    MIDIChannel channel() const { return m_channel; }
-    MIDIKey key() const { return m_key; }
-    uint8_t velocity() const { return m_velocity; }
-    TransitionUnit transition_unit() const { return { m_key, m_channel }; }
-    Type type() const { return m_type; }
-
-    virtual bool is_serializable() const override { return true; }
-    virtual void serialize(std::ostream& stream) const override
-    {
-        fmt::println("SERIALIZE NOTE {} EVENT FOR CHANNEL {} NOTE {}",
-            m_type == Type::On ? "ON" : "OFF", m_channel, m_key.code());
-        if (m_type == Type::On)
-            stream << (uint8_t)(0x90 + m_channel);
-        else
-            stream << (uint8_t)(0x80 + m_channel);
-
-        stream << m_key << m_velocity;
-    }
-
-    virtual std::unique_ptr<Event> clone() const override { return std::make_unique<NoteEvent>(*this); }
-
-private:
-    Type m_type;
-    MIDIChannel m_channel;
-    MIDIKey m_key;
-    uint8_t m_velocity;
-};
-
-template<>
-struct std::hash<NoteEvent::TransitionUnit> {
-    size_t operator()(NoteEvent::TransitionUnit const& tu) const
-    {
-        return (static_cast<size_t>(tu.channel) << 8) | tu.key.code();
-    }
-};
-
-inline bool operator==(NoteEvent::TransitionUnit const& l, NoteEvent::TransitionUnit const& r)
-{
-    return l.channel == r.channel && l.key == r.key;
-}
-
-class ControlChangeEvent : public Event {
-public:
-    // Appendix 1.2 - Table of MIDI Controller Messages (Data Bytes)
-    enum class Number : uint8_t {
-        // 0x0 - 0x3f handled by LMControlChangeEvent
-        DamperPedal = 0x40,
-        Portamento,
-        Sostenuto,
-        SoftPedal,
-        LegatoFootswitch,
-        Hold2,
-        SoundController1,
-        SoundController2,
-        SoundController3,
-        SoundController4,
-        SoundController5,
-        SoundController6,
-        SoundController7,
-        SoundController8,
-        SoundController9,
-        SoundController10,
-        GeneralPurposeController5,
-        GeneralPurposeController6,
-        GeneralPurposeController7,
-        GeneralPurposeController8,
-        PortamentoControl,
-        Effects1Depth = 0x5b,
-        Effects2Depth,
-        Effects3Depth,
-        Effects4Depth,
-        Effects5Depth,
-        DataEntryPlus1,
-        DataEntryMinus1,
-        NonRegisteredParameterNumberLSB,
-        NonRegisteredParameterNumberMSB,
-        RegisteredParameterNumberLSB,
-        RegisteredParameterNumberMSB,
-        AllSoundOff = 0x78,
-        ResetAllControllers,
-        LocalControlOnOff,
-        AllNotesOff,
-        OmniModeOff,
-        OmniModeOn,
-        PolyModeOn,
-        PolyModeOnInclMono,
-        Count
-    };
-
-    ControlChangeEvent(MIDIChannel channel, Number number, uint8_t value)
-        : m_channel(channel)
-        , m_number(number)
+        , m_data1(data1)
+        , m_data2(data2)
         , m_value(value)
     {
     }
 
-    virtual void dump() const override
-    {
-        std::cerr << tick() << ": Control Change Event channel=" << (int)m_channel << ", number=" << std::hex << (int)m_number << std::dec << ", value=" << (int)m_value << std::endl;
-    }
-
-    virtual void execute(MIDIPlayer&) override;
-
-    virtual bool is_serializable() const override { return true; }
-    virtual void serialize(std::ostream& stream) const override
-    {
-        stream.put((uint8_t)(0xb0 + m_channel)); // Control Change
-        stream.put((uint8_t)m_number);           // Number
-        stream.put(m_value);
-    }
-
-    virtual std::unique_ptr<Event> clone() const override { return std::make_unique<ControlChangeEvent>(*this); }
-
-private:
-    MIDIChannel m_channel;
-    Number m_number;
-    uint8_t m_value;
-};
-
-class ProgramChangeEvent : public Event {
-public:
-    ProgramChangeEvent(MIDIChannel channel, uint8_t value)
-        : m_channel(channel)
-        , m_value(value)
-    {
-    }
-
-    virtual void dump() const override
-    {
-        std::cerr << "Program Change Event channel=" << (int)m_channel << ", data=" << std::hex << (int)m_value << std::dec << std::endl;
-    }
-
-    virtual void execute(MIDIPlayer&) override
-    { /* TODO */
-    }
-
-    virtual bool is_serializable() const override { return true; }
-    virtual void serialize(std::ostream& stream) const override
-    {
-        stream.put((uint8_t)(0xc0 + m_channel)); // Program Change
-        stream.put(m_value);
-    }
-
-    virtual std::unique_ptr<Event> clone() const override { return std::make_unique<ProgramChangeEvent>(*this); }
-
-private:
-    MIDIChannel m_channel;
-    uint8_t m_value;
+    size_t m_tick { 0 };
+    Type m_type { Type::Invalid };
+    MIDIChannel m_channel { 0 };
+    uint8_t m_data1 { 0 };
+    uint8_t m_data2 { 0 };
+    uint32_t m_value { 0 };
 };
 
-class LMControlChangeEvent : public Event {
-public:
-    enum class Number {
-        BankSelect,
-        ModulationWheel,
-        BreathControl,
-        FootController = 0x4,
-        PortamentoTime,
-        DataEntry,
-        ChannelVolume,
-        Balance,
-        Pan = 0xa,
-        ExpressionController,
-        EffectControl1,
-        EffectControl2,
-        GeneralPurposeController1 = 0x10,
-        GeneralPurposeController2,
-        GeneralPurposeController3,
-        GeneralPurposeController4,
-    };
-
-    enum class ByteIndex {
-        MSB,
-        LSB
-    };
-
-    LMControlChangeEvent(MIDIChannel channel, ByteIndex byte_index, Number number, uint8_t value)
-        : m_channel(channel)
-        , m_byte_index(byte_index)
-        , m_number(number)
-        , m_value(value)
-    {
-    }
-
-    virtual void dump() const override
-    {
-        std::cerr << "Control Change Event channel=" << (int)m_channel << ", number=" << std::hex << (int)m_number << std::dec
-                  << "(" << (m_byte_index == ByteIndex::MSB ? "MSB" : "LSB") << "), value=" << (int)m_value << std::endl;
-    }
-
-    virtual void execute(MIDIPlayer&) override
-    { /* TODO */
-    }
-
-    virtual bool is_serializable() const override { return true; }
-    virtual void serialize(std::ostream& stream) const override
-    {
-        stream.put((uint8_t)(0xb0 + m_channel)); // Control Change
-        stream.put((uint8_t)m_number | (m_byte_index == ByteIndex::MSB ? 0x20 : 0x0));
-        stream.put(m_value);
-    }
-
-    virtual std::unique_ptr<Event> clone() const override { return std::make_unique<LMControlChangeEvent>(*this); }
-
-private:
-    MIDIChannel m_channel;
-    ByteIndex m_byte_index;
-    Number m_number;
-    uint8_t m_value;
-};
+static_assert(sizeof(Event) == 16);
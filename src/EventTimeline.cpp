@@ -0,0 +1,155 @@
+#include "EventTimeline.h"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+
+EventTimeline::EventTimeline(std::vector<Event> events, std::vector<TrackIndex> track_indices)
+    : m_events(std::move(events))
+    , m_track_indices(std::move(track_indices))
+{
+    assert(m_events.size() == m_track_indices.size());
+}
+
+void EventTimeline::append(std::vector<Track> const& tracks)
+{
+    size_t total_size = m_events.size();
+    for (auto const& track : tracks)
+        total_size += track.events().size();
+    m_events.reserve(total_size);
+    m_track_indices.reserve(total_size);
+
+    // k-way merge with a min-heap of the next event of every track. Heads are ordered by
+    // tick and then by track, packed into a single integer to keep comparisons cheap.
+    constexpr size_t TrackBits = std::numeric_limits<TrackIndex>::digits;
+    auto key_for = [](size_t tick, TrackIndex track) { return (tick << TrackBits) | track; };
+    struct Head {
+        uint64_t key;
+        size_t position;
+    };
+    auto comparator = [](Head const& l, Head const& r) { return l.key > r.key; };
+    std::vector<Head> heap;
+    for (size_t s = 0; s < tracks.size(); s++) {
+        if (!tracks[s].events().empty())
+            heap.push_back({ key_for(tracks[s].events().front().tick(), s), 0 });
+    }
+    std::ranges::make_heap(heap, comparator);
+
+    while (!heap.empty()) {
+        std::ranges::pop_heap(heap, comparator);
+        auto& head = heap.back();
+        auto track = static_cast<TrackIndex>(head.key);
+        auto const& events = tracks[track].events();
+        assert(empty() || m_events.back().tick() <= events[head.position].tick());
+
+        // Take all events of this track up to the next head at once, there are often many of them.
+        uint64_t next_key = heap.size() > 1 ? heap.front().key : std::numeric_limits<uint64_t>::max();
+        do {
+            m_events.push_back(events[head.position]);
+            m_track_indices.push_back(track);
+            head.position++;
+        } while (head.position < events.size() && key_for(events[head.position].tick(), track) < next_key);
+
+        if (head.position == events.size()) {
+            heap.pop_back();
+        } else {
+            head.key = key_for(events[head.position].tick(), track);
+            std::ranges::push_heap(heap, comparator);
+        }
+    }
+}
+
+void EventTimeline::add_event(Event event, TrackIndex track)
+{
+    if (m_max_events > 0 && size() >= m_max_events)
+        remove_first_events(size() - m_max_events + 1);
+
+    // Events are almost always added in time order, so appending is the common case.
+    if (empty() || m_events.back().tick() <= event.tick()) {
+        m_events.push_back(event);
+        m_track_indices.push_back(track);
+    } else {
+        auto index = m_first + upper_bound(event.tick());
+        m_events.insert(m_events.begin() + index, event);
+        m_track_indices.insert(m_track_indices.begin() + index, track);
+    }
+}
+
+size_t EventTimeline::lower_bound(size_t tick) const
+{
+    auto events = this->events();
+    return std::ranges::lower_bound(events, tick, {}, &Event::tick) - events.begin();
+}
+
+size_t EventTimeline::upper_bound(size_t tick) const
+{
+    auto events = this->events();
+    return std::ranges::upper_bound(events, tick, {}, &Event::tick) - events.begin();
+}
+
+std::span<Event const> EventTimeline::events_in_range(size_t start_tick, size_t end_tick) const
+{
+    if (start_tick >= end_tick)
+        return {};
+    auto start = lower_bound(start_tick);
+    return events().subspan(start, lower_bound(end_tick) - start);
+}
+
+std::span<Event const> EventTimeline::Cursor::advance_to(EventTimeline const& timeline, size_t tick)
+{
+    auto events = timeline.events();
+    bool index_is_valid = m_index <= events.size()
+        && (m_index == 0 || events[m_index - 1].tick() < m_tick)
+        && (m_index == events.size() || events[m_index].tick() >= m_tick);
+    if (!index_is_valid)
+        m_index = timeline.lower_bound(m_tick);
+
+    size_t start = m_index;
+    if (tick > m_tick) {
+        // Gallop from the hint and then search, so that passing many events in a frame doesn't
+        // check all of them. Events before m_index are all before `tick`.
+        size_t end = m_index;
+        for (size_t step = 1; end < events.size() && events[end].tick() < tick; step *= 2) {
+            m_index = end + 1;
+            end = std::min(events.size(), end + step);
+        }
+        m_index = std::ranges::lower_bound(events.begin() + m_index, events.begin() + end, tick, {}, &Event::tick) - events.begin();
+    }
+    m_tick = tick;
+    return events.subspan(start, m_index - start);
+}
+
+void EventTimeline::set_max_events(size_t max)
+{
+    m_max_events = max;
+    if (max == 0)
+        return;
+    if (size() > max)
+        remove_first_events(size() - max);
+    m_events.reserve(2 * max);
+    m_track_indices.reserve(2 * max);
+}
+
+void EventTimeline::remove_events_before(size_t tick)
+{
+    remove_first_events(lower_bound(tick));
+}
+
+void EventTimeline::remove_first_events(size_t count)
+{
+    m_first += count;
+    // Reclaim space when removed events outnumber live ones, so that
+    // this is amortized O(1) per event and at most doubles the memory.
+    if (m_first > 0 && m_first >= size()) {
+        m_events.erase(m_events.begin(), m_events.begin() + m_first);
+        m_track_indices.erase(m_track_indices.begin(), m_track_indices.begin() + m_first);
+        m_first = 0;
+    }
+}
+
+void EventTimeline::clear()
+{
+    m_events.clear();
+    m_track_indices.clear();
+    m_first = 0;
+}
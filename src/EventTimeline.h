@@ -0,0 +1,80 @@
+#pragma once
+
+#include "Event.h"
+#include "Track.h"
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// All events of a MIDI input merged into a single time-ordered sequence, so that
+// playing and laying out tiles are linear scans. Events at the same tick are ordered
+// by track, and then by their order in the track.
+//
+// Removing the oldest events only moves the start of the sequence; the space is
+// reclaimed once there are more removed events than live ones. With a limit on
+// the number of events (realtime input), storage for twice the limit is allocated
+// upfront, so that adding and evicting events never allocates.
+class EventTimeline {
+public:
+    // 2.1 - Header Chunks: the number of tracks is a 16-bit number.
+    using TrackIndex = uint16_t;
+
+    EventTimeline() = default;
+
+    // `events` must be sorted by tick.
+    EventTimeline(std::vector<Event> events, std::vector<TrackIndex> track_indices);
+
+    // Merges events of all tracks and appends them. None of them may be before the last event.
+    void append(std::vector<Track> const& tracks);
+
+    // Inserts after all events at the same tick.
+    void add_event(Event event, TrackIndex track);
+
+    bool empty() const { return size() == 0; }
+    size_t size() const { return m_events.size() - m_first; }
+    std::span<Event const> events() const { return std::span { m_events }.subspan(m_first); }
+    std::span<TrackIndex const> track_indices() const { return std::span { m_track_indices }.subspan(m_first); }
+
+    // Index of the first event at or after `tick`
+    size_t lower_bound(size_t tick) const;
+    // Index of the first event after `tick`
+    size_t upper_bound(size_t tick) const;
+
+    // Events in [start_tick, end_tick)
+    std::span<Event const> events_in_range(size_t start_tick, size_t end_tick) const;
+
+    // Position of the playhead, which yields events that became due as it moves forward. Moving
+    // by a frame only searches the events that were passed, not the whole timeline, and doesn't allocate.
+    class Cursor {
+    public:
+        // Returns events in [previous position, tick). Nothing is returned when moving backwards.
+        std::span<Event const> advance_to(EventTimeline const&, size_t tick);
+
+        // Moves to `tick` without returning events that were passed.
+        void seek(size_t tick) { m_tick = tick; }
+
+    private:
+        size_t m_tick {};
+        // Index of the first event at or after m_tick. Only a hint; it's searched again if the
+        // timeline was modified so that it's no longer right.
+        size_t m_index {};
+    };
+
+    // Oldest events are evicted when adding more events than that (0 = unlimited).
+    // Shrinking the limit evicts the oldest events right away; the newest ones are kept.
+    void set_max_events(size_t max);
+
+    void remove_events_before(size_t tick);
+    void clear();
+
+private:
+    void remove_first_events(size_t count);
+
+    // Events before m_first were removed and are waiting to be reclaimed.
+    std::vector<Event> m_events;
+    // Parallel to m_events, so that scanning events doesn't touch them.
+    std::vector<TrackIndex> m_track_indices;
+    size_t m_first = 0;
+    size_t m_max_events = 0;
+};
@@ -0,0 +1,138 @@
+#include "FrameReadback.h"
+
+#include "Logger.h"
+
+#include <SFML/Window/Context.hpp>
+#include <cassert>
+#include <cstring>
+#include <optional>
+#include <type_traits>
+
+namespace {
+
+// Pixel buffer objects are core since OpenGL 2.1, which is newer than the headers SFML provides.
+constexpr GLenum PixelPackBuffer = 0x88EB;
+constexpr GLenum StreamRead = 0x88E1;
+constexpr GLenum ReadOnly = 0x88B8;
+
+}
+
+struct FrameReadback::Functions {
+    void(APIENTRY* gen_buffers)(GLsizei, GLuint*);
+    void(APIENTRY* delete_buffers)(GLsizei, GLuint const*);
+    void(APIENTRY* bind_buffer)(GLenum, GLuint);
+    void(APIENTRY* buffer_data)(GLenum, std::ptrdiff_t, void const*, GLenum);
+    void*(APIENTRY* map_buffer)(GLenum, GLenum);
+    GLboolean(APIENTRY* unmap_buffer)(GLenum);
+
+    // Returns null if some function is not available. Requires an active context.
+    static Functions const* load()
+    {
+        static std::optional<Functions> const functions = []() -> std::optional<Functions> {
+            Functions functions {};
+            auto load_function = [](auto& function, char const* name) {
+                function = reinterpret_cast<std::remove_reference_t<decltype(function)>>(sf::Context::getFunction(name));
+                return function != nullptr;
+            };
+            if (!load_function(functions.gen_buffers, "glGenBuffers")
+                || !load_function(functions.delete_buffers, "glDeleteBuffers")
+                || !load_function(functions.bind_buffer, "glBindBuffer")
+                || !load_function(functions.buffer_data, "glBufferData")
+                || !load_function(functions.map_buffer, "glMapBuffer")
+                || !load_function(functions.unmap_buffer, "glUnmapBuffer")) {
+                return {};
+            }
+            return functions;
+        }();
+        return functions ? &*functions : nullptr;
+    }
+};
+
+FrameReadback::FrameReadback(sf::RenderTexture& texture)
+    : m_texture(texture)
+    , m_size(texture.getSize())
+{
+    if (!m_texture.setActive(true)) {
+        logger::warning("Failed to activate render texture, reading frames synchronously");
+        return;
+    }
+    m_functions = Functions::load();
+    if (!m_functions) {
+        logger::warning("Pixel buffer objects are not supported, reading frames synchronously");
+        return;
+    }
+    m_functions->gen_buffers(m_buffers.size(), m_buffers.data());
+    for (auto buffer : m_buffers) {
+        m_functions->bind_buffer(PixelPackBuffer, buffer);
+        m_functions->buffer_data(PixelPackBuffer, frame_size(), nullptr, StreamRead);
+    }
+    // SFML doesn't expect anything to be bound there.
+    m_functions->bind_buffer(PixelPackBuffer, 0);
+}
+
+FrameReadback::~FrameReadback()
+{
+    if (m_functions && m_texture.setActive(true))
+        m_functions->delete_buffers(m_buffers.size(), m_buffers.data());
+}
+
+void FrameReadback::start()
+{
+    assert(m_pending_frames < RingSize);
+    auto index = (m_oldest_frame + m_pending_frames) % RingSize;
+    m_pending_frames++;
+
+    if (!m_functions) {
+        m_images[index] = m_texture.getTexture().copyToImage();
+        return;
+    }
+
+    // This only schedules a copy, it returns without waiting for the frame to be rendered.
+    if (!m_texture.setActive(true)) {
+        logger::error("Failed to activate render texture to read frame");
+        m_failed = true;
+        return;
+    }
+    m_functions->bind_buffer(PixelPackBuffer, m_buffers[index]);
+    glReadPixels(0, 0, m_size.x, m_size.y, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    m_functions->bind_buffer(PixelPackBuffer, 0);
+    // Make sure that the GPU starts the copy before the buffer is mapped.
+    glFlush();
+}
+
+void FrameReadback::finish(std::span<uint8_t> pixels)
+{
+    assert(m_pending_frames > 0);
+    assert(pixels.size() == frame_size());
+    auto index = m_oldest_frame;
+    m_oldest_frame = (m_oldest_frame + 1) % RingSize;
+    m_pending_frames--;
+
+    if (!m_functions) {
+        if (m_images[index].getSize() != m_size) {
+            logger::error("Failed to copy frame from render texture");
+            m_failed = true;
+            return;
+        }
+        memcpy(pixels.data(), m_images[index].getPixelsPtr(), frame_size());
+        return;
+    }
+
+    if (!m_texture.setActive(true)) {
+        logger::error("Failed to activate render texture to read frame");
+        m_failed = true;
+        return;
+    }
+    m_functions->bind_buffer(PixelPackBuffer, m_buffers[index]);
+    if (auto data = static_cast<uint8_t const*>(m_functions->map_buffer(PixelPackBuffer, ReadOnly))) {
+        // OpenGL stores rows from the bottom one.
+        size_t row_size = size_t(m_size.x) * 4;
+        for (size_t y = 0; y < m_size.y; y++)
+            memcpy(pixels.data() + y * row_size, data + (m_size.y - 1 - y) * row_size, row_size);
+        m_functions->unmap_buffer(PixelPackBuffer);
+    } else {
+        logger::error("Failed to map pixel buffer");
+        m_failed = true;
+    }
+    m_functions->bind_buffer(PixelPackBuffer, 0);
+}
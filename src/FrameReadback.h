@@ -0,0 +1,50 @@
+#pragma once
+
+#include <SFML/Graphics/Image.hpp>
+#include <SFML/Graphics/RenderTexture.hpp>
+#include <SFML/OpenGL.hpp>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+// Reads back pixels of frames rendered to a texture without stalling rendering. The GPU copies
+// every frame into one of a ring of pixel buffer objects, and the frame is only mapped when all
+// of them are in use, by which time the copy is long done and the following frames are already
+// being rendered.
+//
+// Falls back to synchronous reads if pixel buffer objects are not supported.
+class FrameReadback {
+public:
+    static constexpr size_t RingSize = 3;
+
+    // The texture must stay alive and keep its size as long as this object.
+    explicit FrameReadback(sf::RenderTexture&);
+    FrameReadback(FrameReadback const&) = delete;
+    FrameReadback& operator=(FrameReadback const&) = delete;
+    ~FrameReadback();
+
+    size_t frame_size() const { return size_t(m_size.x) * m_size.y * 4; }
+
+    // Starts reading the frame that was last displayed on the texture.
+    // There must be fewer than RingSize pending frames.
+    void start();
+    size_t pending_frames() const { return m_pending_frames; }
+    // Copies RGBA pixels of the oldest pending frame, from the top row.
+    void finish(std::span<uint8_t> pixels);
+    // Some frame couldn't be read, so its pixels were not copied.
+    bool failed() const { return m_failed; }
+
+private:
+    struct Functions;
+
+    sf::RenderTexture& m_texture;
+    sf::Vector2u m_size;
+    Functions const* m_functions {};
+    std::array<GLuint, RingSize> m_buffers {};
+    // Used instead of buffers if they are not supported.
+    std::array<sf::Image, RingSize> m_images;
+    size_t m_oldest_frame = 0;
+    size_t m_pending_frames = 0;
+    bool m_failed = false;
+};
@@ -0,0 +1,99 @@
+#include "FrameWriter.h"
+
+#include "Logger.h"
+
+#include <cerrno>
+#include <cstring>
+
+FrameWriter::FrameWriter(FILE* output, size_t frame_size, size_t max_queued_frames)
+    : m_output(output)
+    , m_frame_size(frame_size)
+    , m_max_queued_frames(max_queued_frames)
+    , m_thread([this] { run(); })
+{
+}
+
+FrameWriter::Frame FrameWriter::acquire_frame()
+{
+    std::unique_lock lock { m_mutex };
+    if (m_free_frames.empty() && m_allocated_frames < m_max_queued_frames) {
+        m_allocated_frames++;
+        return Frame(m_frame_size);
+    }
+    if (m_free_frames.empty()) {
+        auto wait_start = std::chrono::steady_clock::now();
+        m_frame_written.wait(lock, [&] { return !m_free_frames.empty(); });
+        m_stats.blocked_time += std::chrono::steady_clock::now() - wait_start;
+    }
+    auto frame = std::move(m_free_frames.back());
+    m_free_frames.pop_back();
+    return frame;
+}
+
+void FrameWriter::submit_frame(Frame&& frame)
+{
+    {
+        std::lock_guard lock { m_mutex };
+        m_queued_frames.push_back(std::move(frame));
+    }
+    m_frame_submitted.notify_one();
+}
+
+void FrameWriter::close()
+{
+    if (!m_thread.joinable())
+        return;
+    {
+        std::lock_guard lock { m_mutex };
+        m_closing = true;
+    }
+    m_frame_submitted.notify_one();
+    m_thread.join();
+    if (fflush(m_output) != 0)
+        m_failed = true;
+}
+
+bool FrameWriter::failed() const
+{
+    std::lock_guard lock { m_mutex };
+    return m_failed;
+}
+
+FrameWriter::Stats FrameWriter::stats() const
+{
+    std::lock_guard lock { m_mutex };
+    auto stats = m_stats;
+    stats.queued_frames = m_queued_frames.size();
+    return stats;
+}
+
+void FrameWriter::run()
+{
+    std::unique_lock lock { m_mutex };
+    while (true) {
+        m_frame_submitted.wait(lock, [&] { return m_closing || !m_queued_frames.empty(); });
+        if (m_queued_frames.empty())
+            break;
+        auto frame = std::move(m_queued_frames.front());
+        m_queued_frames.pop_front();
+        bool failed = m_failed;
+        lock.unlock();
+
+        auto write_start = std::chrono::steady_clock::now();
+        if (!failed && fwrite(frame.data(), 1, frame.size(), m_output) != frame.size()) {
+            logger::error("Failed to write frame: {}", strerror(errno));
+            failed = true;
+        }
+        auto write_time = std::chrono::steady_clock::now() - write_start;
+
+        lock.lock();
+        m_failed = failed;
+        if (!failed) {
+            m_stats.frames_written++;
+            m_stats.bytes_written += frame.size();
+            m_stats.write_time += write_time;
+        }
+        m_free_frames.push_back(std::move(frame));
+        m_frame_written.notify_one();
+    }
+}
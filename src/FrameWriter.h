@@ -0,0 +1,66 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Writes rendered frames to a file (usually a pipe to an encoder) on a separate thread,
+// so that rendering only waits for the consumer if it falls behind by more than a few
+// frames. Frame buffers are recycled, so that there is no allocation per frame.
+class FrameWriter {
+public:
+    using Frame = std::vector<uint8_t>;
+
+    FrameWriter(FILE* output, size_t frame_size, size_t max_queued_frames);
+    FrameWriter(FrameWriter const&) = delete;
+    FrameWriter& operator=(FrameWriter const&) = delete;
+    // Writes all queued frames.
+    ~FrameWriter() { close(); }
+
+    // Returns a buffer of frame_size bytes to fill with the next frame. Blocks while
+    // all buffers are queued for writing.
+    Frame acquire_frame();
+    void submit_frame(Frame&&);
+    // Writes all queued frames and stops the thread. No frames can be submitted after that.
+    void close();
+
+    // Writing failed, e.g because the other end of a pipe was closed. Later frames are dropped.
+    bool failed() const;
+
+    struct Stats {
+        size_t frames_written = 0;
+        size_t bytes_written = 0;
+        size_t queued_frames = 0;
+        // Time spent waiting for a free buffer, i.e how much the consumer slowed rendering down.
+        std::chrono::duration<double> blocked_time {};
+        std::chrono::duration<double> write_time {};
+    };
+    Stats stats() const;
+    size_t max_queued_frames() const { return m_max_queued_frames; }
+
+private:
+    void run();
+
+    FILE* m_output {};
+    size_t m_frame_size {};
+    size_t m_max_queued_frames {};
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_frame_submitted;
+    std::condition_variable m_frame_written;
+    std::deque<Frame> m_queued_frames;
+    std::vector<Frame> m_free_frames;
+    size_t m_allocated_frames = 0;
+    bool m_closing = false;
+    bool m_failed = false;
+    Stats m_stats;
+
+    // Last, so that the thread starts when everything else is initialized.
+    std::jthread m_thread;
+};
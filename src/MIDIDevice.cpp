@@ -2,8 +2,8 @@
 
 #include "Logger.h"
 #include "MIDIPlayer.h"
-#include "SpanStream.h"
 
+#include <algorithm>
 #include <atomic>
 #include <cassert>
 #include <cstring>
@@ -14,8 +14,6 @@ using namespace std::chrono_literals;
 
 MIDIDeviceInput::MIDIDeviceInput(int port)
 {
-    m_tracks.resize(1);
-
     m_input.setClientName("MIDIPlayer");
     m_input.setPortName("MIDIPlayer Input");
     m_input.setCallback([](double, std::vector<uint8_t>* data, void* user_data) {
@@ -26,8 +24,8 @@ MIDIDeviceInput::MIDIDeviceInput(int port)
             if(!player)
                 return;
     
-            ISpanStream stream({data->data(), data->size()});
-            auto event = this_->MIDIInput::read_event(stream);
+            ByteReader reader({data->data(), data->size()});
+            auto event = this_->MIDIInput::read_event(reader);
             if(!event)
             {
                 logger::error("Failed to read event");
@@ -37,7 +35,7 @@ MIDIDeviceInput::MIDIDeviceInput(int port)
             event->set_tick(this_->current_tick(*player));
     
             std::lock_guard lock{this_->m_event_queue_mutex};
-            this_->m_event_queue.push(std::move(event)); },
+            this_->m_event_queue.push(*event); },
         this);
     try {
         m_input.openPort(port);
@@ -48,12 +46,12 @@ MIDIDeviceInput::MIDIDeviceInput(int port)
     m_valid = true;
 }
 
-std::unique_ptr<Event> MIDIDeviceInput::read_event()
+std::optional<Event> MIDIDeviceInput::read_event()
 {
     std::lock_guard lock { m_event_queue_mutex };
     if (m_event_queue.empty())
-        return nullptr;
-    auto event = std::move(m_event_queue.front());
+        return {};
+    auto event = m_event_queue.front();
     m_event_queue.pop();
     return event;
 }
@@ -63,17 +61,25 @@ void MIDIDeviceInput::update(MIDIPlayer& player)
     m_player = &player;
     while (auto event = read_event()) {
         // Do not store invalid events
-        if (dynamic_cast<InvalidEvent*>(event.get()))
+        if (event->type() == Event::Type::Invalid)
             continue;
-        m_tracks[0].add_event(std::move(event));
+        m_timeline.add_event(*event, 0);
         player.did_read_events(1);
     }
+
+    // Played notes scroll off the screen for good, so keep only tiles that can still be visible
+    // (plus a few frames) to not grow without bound in long sessions.
+    size_t tick = current_tick(player);
+    auto window = visible_ticks_with_margin(player, tick);
+    size_t ticks_visible = std::max(window.ahead, window.behind);
+    if (tick > ticks_visible)
+        player.tile_world().remove_tiles_before(tick - ticks_visible);
 }
 
 size_t MIDIDeviceInput::current_tick(MIDIPlayer const& player) const
 {
     auto time = (std::chrono::system_clock::now() - player.start_time());
-    return time / 1us * ((double)ticks_per_quarter_note() / player.microseconds_per_quarter_note());
+    return m_tempo_map.microseconds_to_tick(time / 1us);
 }
 
 ////////////
@@ -17,7 +17,7 @@ public:
     MIDIDeviceInput(int port);
 
     virtual bool is_valid() const override { return m_valid.load(std::memory_order_relaxed); }
-    std::unique_ptr<Event> read_event();
+    std::optional<Event> read_event();
     virtual void update(MIDIPlayer&) override;
 
     virtual uint16_t ticks_per_quarter_note() const override { return 192; }
@@ -25,7 +25,7 @@ public:
     virtual std::optional<size_t> end_tick() const override { return {}; }
 
 private:
-    std::queue<std::unique_ptr<Event>> m_event_queue;
+    std::queue<Event> m_event_queue;
     std::mutex m_event_queue_mutex;
     std::atomic<bool> m_valid;
     std::atomic<MIDIPlayer*> m_player { nullptr };
@@ -3,13 +3,19 @@
 #include "Event.h"
 #include "Logger.h"
 #include "MIDIPlayer.h"
+
+#include <algorithm>
+#include <atomic>
 #include <bit>
+#include <limits>
+#include <numeric>
+#include <thread>
 
 using namespace std::literals;
 
 void MIDIFileInput::update(MIDIPlayer& player)
 {
-    m_tick += ticks_per_quarter_note() * 1000000.0 / player.microseconds_per_quarter_note() / player.fps();
+    m_tick = m_tempo_map.microseconds_to_tick(m_tempo_map.tick_to_microseconds(m_tick) + 1000000.0 / player.fps());
 }
 
 void MIDIFileInput::dump() const
@@ -20,206 +26,295 @@ void MIDIFileInput::dump() const
 
     else
         std::cerr << "ticks_per_quarter_note=" << m_ticks_per_quarter_note << std::endl;
-    std::cerr << "track count: " << m_tracks.size() << std::endl;
+    std::cerr << "track count: " << m_track_count << std::endl;
+}
+
+bool MIDIFileInput::read_midi(std::span<uint8_t const> data, unsigned thread_count)
+{
+    // Find all track chunks first so that they can be decoded independently.
+    std::vector<TrackChunk> track_chunks;
+    if (!read_chunks(data, track_chunks))
+        return false;
+    return read_tracks(data, track_chunks, thread_count);
 }
 
-bool MIDIFileInput::read_midi(std::istream& in)
+bool MIDIFileInput::read_chunks(std::span<uint8_t const> data, std::vector<TrackChunk>& track_chunks)
 {
-    if (!in.good()) {
-        logger::error("Empty or invalid stream");
+    if (data.empty()) {
+        logger::error("Empty or invalid file");
         return false;
     }
 
-    while (!in.eof()) {
-        if (!read_chunk(in))
+    ByteReader reader { data };
+    while (!reader.eof()) {
+        if (!read_chunk(reader, track_chunks))
             return false;
     }
-
     return true;
 }
 
-#define ERROR(msg)                                                \
-    do {                                                          \
-        logger::error("Failed to {}", msg);                       \
-        logger::error_note("at offset {:x}", (size_t)in.tellg()); \
-        return {};                                                \
+#define ERROR(msg)                                              \
+    do {                                                        \
+        logger::error("Failed to {}", msg);                     \
+        logger::error_note("at offset {:x}", reader.offset()); \
+        return {};                                              \
     } while (false)
 
 // 1.3 - Chunks
-bool MIDIFileInput::read_chunk(std::istream& in)
+bool MIDIFileInput::read_chunk(ByteReader& reader, std::vector<TrackChunk>& track_chunks)
 {
-    char type[5] {};
-    uint32_t length;
-    if (!in.read(type, 4))
-        return in.eof();
-    if (!in.read((char*)&length, 4))
+    // Ignore trailing garbage that is too short to be a chunk
+    auto type_bytes = reader.read_bytes(4);
+    if (!type_bytes)
+        return true;
+    auto length = reader.read_u32_be();
+    if (!length)
         ERROR("read chunk length");
 
-    length = htobe32(length);
-
-    std::string_view type_sv = type;
+    std::string_view type_sv { reinterpret_cast<char const*>(type_bytes->data()), type_bytes->size() };
     if (type_sv == "MThd"sv) {
         if (m_header_encountered) {
             logger::error("Header encountered twice");
             return false;
         }
         m_header_encountered = true;
-        return read_header(in);
+        // The header may be longer in future versions of the format
+        auto header = reader.read_bytes(*length);
+        if (!header)
+            ERROR("read header");
+        ByteReader header_reader { *header };
+        return read_header(header_reader);
     }
     if (type_sv == "MTrk"sv) {
         if (!m_header_encountered) {
             logger::error("MTrk without header");
             return false;
         }
-        return read_track_data(in, length);
+        // at least one MTrk event must be present
+        if (*length == 0) {
+            logger::error("No events in track");
+            return false;
+        }
+        track_chunks.push_back({ reader.offset(), *length });
+        if (!reader.skip(*length))
+            ERROR("read track data");
+        return true;
     }
 
     // Your programs should EXPECT alien chunks and treat them as if they weren't there
-    std::cerr << "Ignoring alien chunk (" << length << " bytes)" << std::endl;
-    if (!in.ignore(length))
+    std::cerr << "Ignoring alien chunk (" << *length << " bytes)" << std::endl;
+    if (!reader.skip(*length))
         ERROR("ignore alien chunk");
 
     return true;
 }
 
 // 2.1 - Header Chunks
-bool MIDIFileInput::read_header(std::istream& in)
+bool MIDIFileInput::read_header(ByteReader& reader)
 {
-    uint16_t format, ntrks, division;
-    if (!in.read((char*)&format, 2))
+    auto format = reader.read_u16_be();
+    if (!format)
         ERROR("read format");
-    if (!in.read((char*)&ntrks, 2))
+    auto ntrks = reader.read_u16_be();
+    if (!ntrks)
         ERROR("read ntrks");
-    if (!in.read((char*)&division, 2))
+    auto division = reader.read_u16_be();
+    if (!division)
         ERROR("read division");
 
-    format = htobe16(format);
-    ntrks = htobe16(ntrks);
-    division = htobe16(division);
-
-    if (format > 2) {
+    if (*format > 2) {
         logger::error("Invalid format value");
         return false;
     }
-    m_format = static_cast<MIDIFileFormat>(format);
-    if (m_format == MIDIFileFormat::SingleMultichannelTrack && ntrks > 1) {
+    m_format = static_cast<MIDIFileFormat>(*format);
+    if (m_format == MIDIFileFormat::SingleMultichannelTrack && *ntrks > 1) {
         logger::error("Multiple tracks in single multichannel track format");
         return false;
     }
-    m_tracks.reserve(ntrks);
 
-    if (division & 0x8000) {
+    if (*division & 0x8000) {
         m_is_smpte = true;
-        m_negative_smpte_format = division & 0x7f00 >> 8;
-        m_ticks_per_frame = division & 0xff;
+        m_negative_smpte_format = (*division & 0x7f00) >> 8;
+        m_ticks_per_frame = *division & 0xff;
     } else {
         m_is_smpte = false;
-        m_ticks_per_quarter_note = division & 0x7fff;
+        m_ticks_per_quarter_note = *division & 0x7fff;
     }
 
     return true;
 }
 
-// 2.3 - Track Chunks
-bool MIDIFileInput::read_track_data(std::istream& in, size_t length)
+bool MIDIFileInput::read_tracks(std::span<uint8_t const> data, std::vector<TrackChunk> const& track_chunks, unsigned thread_count)
 {
-    // at least one MTrk event must be present
-    if (length == 0) {
-        logger::error("No events in track");
+    std::vector<Track> tracks(track_chunks.size());
+    bool success = decode_tracks(track_chunks, thread_count, [&](size_t index, size_t& end_tick, std::vector<TempoMap::TempoChange>& tempo_changes) {
+        TrackDecoder decoder { data, track_chunks[index] };
+        return read_track_data(decoder, tracks[index], m_payloads, end_tick, tempo_changes);
+    });
+    if (!success)
+        return false;
+    m_timeline.append(tracks);
+    m_keyframes.build(m_timeline);
+    return true;
+}
+
+bool MIDIFileInput::decode_tracks(std::vector<TrackChunk> const& track_chunks, unsigned thread_count, TrackDecodeCallback const& decode_track)
+{
+    if (track_chunks.size() > std::numeric_limits<EventTimeline::TrackIndex>::max()) {
+        logger::error("Too many tracks");
         return false;
     }
-    Track track;
-    size_t offset = in.tellg();
-    size_t end = offset + length;
-    size_t current_tick = 0;
-    while (offset < end) {
-        auto delta_time = read_variable_length_quantity(in);
-        if (!delta_time.has_value())
-            ERROR("read delta time");
-        current_tick += delta_time.value();
-
-        auto event = [&]() -> std::unique_ptr<Event> {
-            uint8_t status = in.peek();
-            if (in.eof())
-                ERROR("peek status");
-
-            // Running status is used: status bytes of MIDI channel messages may be
-            // omitted if the preceding event is a MIDI channel message with the
-            // same status.
-            if (status & 0x80) {
-                if (!(in.read((char*)&status, 1)))
-                    ERROR("read status");
-                m_running_status = status;
-            } else {
-                status = m_running_status;
-            }
-
-            // 3 - Meta-Events
-            if (status == 0xff) {
-                uint8_t type = 0;
-                if (!(in.read((char*)&type, 1)))
-                    return {};
-                return read_meta_event(in, type);
-            }
-
-            // Appendix 1.1 - Table of Major MIDI Messages
-            if (status >= 0x80 && status <= 0xef)
-                return read_channeled_event(in, status & 0xf0, status & 0x0f);
-
-            logger::error("Invalid status number: {:#x}", (int)status);
-            ERROR("status number");
-        }();
-        if (!event)
-            ERROR("read event");
-        event->set_tick(current_tick);
-        if (dynamic_cast<EndOfTrackEvent*>(event.get()) && current_tick > m_end_tick)
-            m_end_tick = current_tick;
-        track.add_event(std::move(event));
-        offset = in.tellg();
+    m_track_count = track_chunks.size();
+    std::vector<size_t> end_ticks(track_chunks.size());
+    std::vector<std::vector<TempoMap::TempoChange>> tempo_changes(track_chunks.size());
+    // NOTE: Not std::vector<bool>, every thread writes its own element.
+    std::vector<uint8_t> results(track_chunks.size());
+
+    for_each_track_chunk(track_chunks, thread_count, [&](size_t index) {
+        results[index] = decode_track(index, end_ticks[index], tempo_changes[index]);
+    });
+
+    std::vector<TempoMap::TempoChange> all_tempo_changes;
+    for (size_t s = 0; s < track_chunks.size(); s++) {
+        if (!results[s]) {
+            logger::error_note("in track {}", s);
+            return false;
+        }
+        m_end_tick = std::max(m_end_tick, end_ticks[s]);
+        all_tempo_changes.insert(all_tempo_changes.end(), tempo_changes[s].begin(), tempo_changes[s].end());
     }
-    m_tracks.push_back(std::move(track));
+    build_tempo_map(std::move(all_tempo_changes));
     return true;
 }
 
-// 1.1 - Variable Length Quantity
-std::optional<uint32_t> MIDIFileInput::read_variable_length_quantity(std::istream& in) const
+void MIDIFileInput::build_tempo_map(std::vector<TempoMap::TempoChange> tempo_changes)
+{
+    if (!m_is_smpte) {
+        m_tempo_map = TempoMap { m_ticks_per_quarter_note, std::move(tempo_changes) };
+        return;
+    }
+
+    // 2.1 - Header Chunks: SMPTE format is stored as a negative two's complement number
+    // (-24, -25, -29 or -30), where -29 stands for 30 drop frame (29.97 fps).
+    int frames_per_second = 128 - m_negative_smpte_format;
+    double exact_frames_per_second = frames_per_second == 29 ? 29.97 : frames_per_second;
+    m_tempo_map = TempoMap::with_constant_rate(exact_frames_per_second * m_ticks_per_frame);
+}
+
+void MIDIFileInput::for_each_track_chunk(std::vector<TrackChunk> const& track_chunks, unsigned thread_count, std::function<void(size_t)> const& callback)
 {
-    uint32_t value = 0;
-    while (true) {
-        uint8_t byte = 0;
-        if (!(in.read((char*)&byte, 1)))
-            ERROR("read vlq");
-
-        value <<= 7;
-        value |= byte & 0x7f;
-        if (!(byte & 0x80))
-            return value;
+    thread_count = std::min<size_t>(thread_count, track_chunks.size());
+    if (thread_count <= 1) {
+        for (size_t s = 0; s < track_chunks.size(); s++)
+            callback(s);
+        return;
     }
-    return {};
+
+    // Start with the biggest tracks so that no thread is left with a huge one at the end.
+    std::vector<size_t> order(track_chunks.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::ranges::sort(order, std::greater {}, [&](size_t index) { return track_chunks[index].length; });
+
+    std::atomic<size_t> next { 0 };
+    std::vector<std::jthread> workers;
+    for (unsigned s = 0; s < thread_count; s++) {
+        workers.emplace_back([&] {
+            for (size_t i = next++; i < order.size(); i = next++)
+                callback(order[i]);
+        });
+    }
+    // Join all workers
+    workers.clear();
 }
 
-std::unique_ptr<Event> MIDIFileInput::read_meta_event(std::istream& in, uint8_t type)
+// 2.3 - Track Chunks
+bool MIDIFileInput::read_track_data(TrackDecoder& decoder, Track& track, EventPayloads& payloads, size_t& end_tick, std::vector<TempoMap::TempoChange>& tempo_changes)
 {
-    auto read_string = [](std::istream& in, uint8_t len) -> std::optional<std::string> {
-        std::string data;
-        data.resize(len);
-        if (!in.read(data.data(), len))
-            return {};
-        return data;
-    };
-
-    auto len = read_variable_length_quantity(in);
+    while (!decoder.eof()) {
+        auto event = decoder.read_event(payloads);
+        if (!event)
+            return false;
+        if (event->type() == Event::Type::EndOfTrack && event->tick() > end_tick)
+            end_tick = event->tick();
+        else if (event->type() == Event::Type::SetTempo)
+            tempo_changes.push_back({ event->tick(), event->microseconds_per_quarter_note() });
+        track.add_event(*event);
+    }
+    return true;
+}
+
+MIDIFileInput::TrackDecoder::TrackDecoder(std::span<uint8_t const> data, TrackChunk chunk)
+    : TrackDecoder(data, chunk, State { .offset = chunk.offset })
+{
+}
+
+MIDIFileInput::TrackDecoder::TrackDecoder(std::span<uint8_t const> data, TrackChunk chunk, State state)
+    : m_reader(data.first(chunk.offset + chunk.length))
+    , m_tick(state.tick)
+    , m_running_status(state.running_status)
+{
+    // NOTE: The reader covers the whole file (and not only the chunk) so that offsets in errors are absolute.
+    m_reader.skip(state.offset);
+}
+
+std::optional<Event> MIDIFileInput::TrackDecoder::read_event(EventPayloads& payloads)
+{
+    auto& reader = m_reader;
+    auto delta_time = reader.read_variable_length_quantity();
+    if (!delta_time.has_value())
+        ERROR("read delta time");
+    m_tick += delta_time.value();
+
+    auto event = [&]() -> std::optional<Event> {
+        auto status = reader.peek_u8();
+        if (!status)
+            ERROR("peek status");
+
+        // Running status is used: status bytes of MIDI channel messages may be
+        // omitted if the preceding event is a MIDI channel message with the
+        // same status.
+        if (*status & 0x80) {
+            reader.skip(1);
+            m_running_status = *status;
+        } else {
+            status = m_running_status;
+        }
+
+        // 3 - Meta-Events
+        if (*status == 0xff) {
+            auto type = reader.read_u8();
+            if (!type)
+                return {};
+            return read_meta_event(reader, payloads, *type);
+        }
+
+        // Appendix 1.1 - Table of Major MIDI Messages
+        if (*status >= 0x80 && *status <= 0xef)
+            return read_channeled_event(reader, *status & 0xf0, *status & 0x0f);
+
+        logger::error("Invalid status number: {:#x}", (int)*status);
+        ERROR("status number");
+    }();
+    if (!event)
+        ERROR("read event");
+    event->set_tick(m_tick);
+    return event;
+}
+
+std::optional<Event> MIDIFileInput::read_meta_event(ByteReader& reader, EventPayloads& payloads, uint8_t type)
+{
+    auto len = reader.read_variable_length_quantity();
     if (!len.has_value())
         return {};
+    auto data = reader.read_bytes(len.value());
+    if (!data.has_value())
+        return {};
 
     // std::cerr << "meta-event type=" << std::hex << (int)type << std::dec << " len=" << len.value() << std::endl;
     //  3.1 - Meta-Event Definitions
     switch (type) {
         case 0x00: // Sequence Number
-            // "This optional event, which must occur at the beginning of a track"
-            std::cerr << "Sequence Number" << std::endl;
-            in.ignore(1);
-            return {};
+            break;
         case 0x01: // Text Event
         case 0x02: // Copyright Notice
         case 0x03: // Sequence/Track Name
@@ -227,63 +322,47 @@ std::unique_ptr<Event> MIDIFileInput::read_meta_event(std::istream& in, uint8_t
         case 0x05: // Lyric
         case 0x06: // Marker
         case 0x07: // Cue Point
-        {
-            auto data = read_string(in, len.value());
-            if (!data.has_value())
-                return {};
-            return std::make_unique<TextEvent>(static_cast<TextEvent::Type>(type - 1), data.value());
-        }
+            return Event::text(static_cast<Event::TextType>(type - 1),
+                payloads.add({ reinterpret_cast<char const*>(data->data()), data->size() }));
         case 0x20: // MIDI Channel Prefix
             break;
         case 0x2f: // End of Track
-            return std::make_unique<EndOfTrackEvent>();
+            return Event::end_of_track();
         case 0x51: // Set Tempo
         {
-            uint32_t tempo_val = 0;
-            for (int i = 0; i < 3; i++) {
-                uint8_t data = 0;
-                if (!in.read((char*)&data, 1))
-                    return {};
-                tempo_val <<= 8;
-                tempo_val |= data;
-            }
-            return std::make_unique<SetTempoEvent>(tempo_val);
+            if (data->size() < 3)
+                return {};
+            uint32_t tempo_val = ((*data)[0] << 16) | ((*data)[1] << 8) | (*data)[2];
+            return Event::set_tempo(tempo_val);
         }
         case 0x54: // SMPTE Offset
             break;
         case 0x58: // Time Signature
         {
-            uint8_t numerator = in.get();
-            uint8_t denominator = in.get();
-            uint8_t clocks_per_metronome_click = in.get();
-            uint8_t _32s_in_quarter_note = in.get();
-            if (!in.good())
+            if (data->size() < 4)
                 return {};
-            // FIXME: The denominator is a negative power of two: 2 represents a quarter-note, 3 represents an eighth-note
-            return std::make_unique<TimeSignatureEvent>(numerator, 1 << denominator, clocks_per_metronome_click, _32s_in_quarter_note);
+            uint8_t numerator = (*data)[0];
+            uint8_t denominator = (*data)[1];
+            uint8_t clocks_per_metronome_click = (*data)[2];
+            uint8_t _32s_in_quarter_note = (*data)[3];
+            return Event::time_signature(numerator, denominator, clocks_per_metronome_click, _32s_in_quarter_note);
         }
         case 0x59: // Key Signature
             break;
         case 0x7f: // Sequencer Specific Meta-Event
             break;
     }
-    if (!in.ignore(len.value()))
-        return {};
-    return std::make_unique<InvalidEvent>(type);
+    return Event::invalid(type);
 }
 
 void MIDIFileInput::move_forward(bool to_next_event)
 {
     if (to_next_event) {
-        size_t tick = 0;
-        for (auto const& track : m_tracks) {
-            for (auto const& event : track.events()) {
-                if (event.first > m_tick && (event.first < tick || tick == 0)) {
-                    tick = event.first;
-                }
-            }
+        auto index = m_timeline.upper_bound(static_cast<size_t>(m_tick));
+        if (index < m_timeline.size()) {
+            size_t tick = m_timeline.events()[index].tick();
+            m_tick = tick - std::min<size_t>(tick, 10);
         }
-        m_tick = tick - 10;
     } else {
         m_tick += 50;
     }
@@ -319,15 +398,15 @@ MIDIFileOutput::MIDIFileOutput(std::string path)
     m_output.write("MTrk", 4);
     m_track_length_offset = m_output.tellp();
     m_output.write("\0\0\0\0", 4); // Length (To be filled out later)
-    write_event(TimeSignatureEvent { 4, 4, 0, 0 });
-    write_event(SetTempoEvent { 500000 });
+    write_event(Event::time_signature(4, 2, 0, 0));
+    write_event(Event::set_tempo(500000));
     m_output.flush();
 }
 
 MIDIFileOutput::~MIDIFileOutput()
 {
     // Write End Of Track event
-    EndOfTrackEvent event;
+    auto event = Event::end_of_track();
     event.set_tick(m_last_tick + 192);
     write_event(event);
     // std::cerr << "MIDIFileOutput: Closed successfully" << std::endl;
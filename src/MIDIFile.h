@@ -1,9 +1,15 @@
 #pragma once
 
+#include "ByteReader.h"
 #include "MIDIInput.h"
 #include "MIDIOutput.h"
+#include "PlaybackState.h"
+#include "Track.h"
 
 #include <fstream>
+#include <functional>
+#include <optional>
+#include <span>
 
 // Based on https://www.cs.cmu.edu/~music/cmsip/readings/Standard-MIDI-file-format-updated.pdf
 
@@ -15,7 +21,8 @@ enum class MIDIFileFormat {
 };
 class MIDIFileInput : public MIDIInput {
 public:
-    MIDIFileInput(std::istream& in) { m_valid = read_midi(in); }
+    // Tracks are decoded in parallel on up to `thread_count` threads.
+    explicit MIDIFileInput(std::span<uint8_t const> data, unsigned thread_count = 1) { m_valid = read_midi(data, thread_count); }
 
     virtual uint16_t ticks_per_quarter_note() const override { return m_ticks_per_quarter_note; }
     virtual bool is_valid() const override { return m_valid; }
@@ -23,12 +30,67 @@ public:
     virtual size_t current_tick(MIDIPlayer const&) const override { return m_tick; }
     virtual std::optional<size_t> end_tick() const override { return m_end_tick; }
 
+    size_t track_count() const { return m_track_count; }
+
     void dump() const;
 
     void move_forward(bool to_next_note);
-    void seek(size_t tick);
+    virtual void seek(size_t tick);
+
+    // State after playing all events before `tick`, found from the nearest keyframe.
+    virtual std::optional<PlaybackState> playback_state_at(size_t tick) const { return m_keyframes.state_at(m_timeline, tick); }
+
+protected:
+    friend class MIDIFileCache;
+
+    // For MIDIFileCache and MIDIFileStreamInput, which fill in everything themselves.
+    MIDIFileInput() = default;
+
+    struct TrackChunk {
+        size_t offset;
+        size_t length;
+    };
+
+    // Decodes events of a single track chunk one by one.
+    class TrackDecoder {
+    public:
+        // Everything needed to resume decoding at some event.
+        struct State {
+            size_t offset {};
+            size_t tick {};
+            uint8_t running_status {};
+        };
+
+        TrackDecoder(std::span<uint8_t const> data, TrackChunk chunk);
+        TrackDecoder(std::span<uint8_t const> data, TrackChunk chunk, State state);
+
+        bool eof() const { return m_reader.eof(); }
+        State state() const { return { m_reader.offset(), m_tick, m_running_status }; }
+
+        // Returns nothing (and logs) if the event couldn't be decoded.
+        std::optional<Event> read_event(EventPayloads& payloads);
+
+    private:
+        ByteReader m_reader;
+        size_t m_tick {};
+        // Running status doesn't carry over between tracks
+        uint8_t m_running_status {};
+    };
+
+    bool read_chunks(std::span<uint8_t const> data, std::vector<TrackChunk>& track_chunks);
+
+    // Calls `callback(index)` for every track chunk, on up to `thread_count` threads.
+    static void for_each_track_chunk(std::vector<TrackChunk> const& track_chunks, unsigned thread_count, std::function<void(size_t)> const& callback);
+
+    // Runs `decode_track(index, end_tick, tempo_changes)` for every track chunk, on up to `thread_count` threads,
+    // then sets the end tick and builds the tempo map from what all tracks reported. Returns false (and logs)
+    // if there are too many tracks or decoding some track failed.
+    using TrackDecodeCallback = std::function<bool(size_t index, size_t& end_tick, std::vector<TempoMap::TempoChange>& tempo_changes)>;
+    bool decode_tracks(std::vector<TrackChunk> const& track_chunks, unsigned thread_count, TrackDecodeCallback const& decode_track);
+
+    // Must be called after the header is read.
+    void build_tempo_map(std::vector<TempoMap::TempoChange> tempo_changes);
 
-private:
     bool m_valid { false };
     bool m_header_encountered { false };
 
@@ -44,16 +106,18 @@ private:
 
     double m_tick {};
     size_t m_end_tick {};
+    size_t m_track_count {};
+    PlaybackKeyframes m_keyframes;
 
-    uint8_t m_running_status = 0;
-
-    bool read_midi(std::istream& in);
-    bool read_chunk(std::istream& in);
-    bool read_header(std::istream& in);
-    bool read_track_data(std::istream& in, size_t length);
-
-    std::optional<uint32_t> read_variable_length_quantity(std::istream& in) const;
-    std::unique_ptr<Event> read_meta_event(std::istream& in, uint8_t type);
+private:
+    bool read_midi(std::span<uint8_t const> data, unsigned thread_count);
+    bool read_chunk(ByteReader& reader, std::vector<TrackChunk>& track_chunks);
+    bool read_header(ByteReader& reader);
+    bool read_tracks(std::span<uint8_t const> data, std::vector<TrackChunk> const& track_chunks, unsigned thread_count);
+
+    // These only touch the given track and the (thread-safe) payload table so that tracks can be decoded concurrently.
+    static bool read_track_data(TrackDecoder& decoder, Track& track, EventPayloads& payloads, size_t& end_tick, std::vector<TempoMap::TempoChange>& tempo_changes);
+    static std::optional<Event> read_meta_event(ByteReader& reader, EventPayloads& payloads, uint8_t type);
 };
 
 class MIDIFileOutput : public MIDIOutput {
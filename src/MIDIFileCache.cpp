@@ -0,0 +1,329 @@
+#include "MIDIFileCache.h"
+
+#include "ByteReader.h"
+#include "Logger.h"
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fmt/format.h>
+#include <fstream>
+#include <type_traits>
+
+namespace {
+
+constexpr char Magic[8] = { 'M', 'P', 'C', 'A', 'C', 'H', 'E', '\0' };
+
+// All sections start at a multiple of this, so that they can be read through pointers to their types.
+constexpr size_t SectionAlignment = 8;
+
+struct Header {
+    char magic[8];
+    uint32_t format_version;
+    uint16_t ticks_per_quarter_note;
+    uint8_t format;
+    uint8_t is_smpte;
+    uint8_t negative_smpte_format;
+    uint8_t ticks_per_frame;
+    uint8_t padding[6];
+    uint64_t source_hash;
+    uint64_t source_size;
+    uint64_t end_tick;
+    uint64_t track_count;
+    uint64_t event_count;
+    uint64_t payload_count;
+    uint64_t payload_data_size;
+    uint64_t tile_count;
+    uint64_t tempo_change_count;
+    // Followed by:
+    // Event events[event_count]; (in EventTimeline order)
+    // uint16_t track_indices[event_count]; (padded to SectionAlignment)
+    // uint64_t payload_offsets[payload_count + 1];
+    // char payload_data[payload_data_size]; (padded to SectionAlignment)
+    // CachedTile tiles[tile_count];
+    // CachedTempoChange tempo_changes[tempo_change_count];
+};
+
+struct CachedTile {
+    uint64_t start_tick;
+    uint64_t end_tick;
+    uint8_t key;
+    uint8_t channel;
+    uint8_t has_end_tick;
+    uint8_t padding[5];
+};
+
+struct CachedTempoChange {
+    uint64_t tick;
+    uint32_t microseconds_per_quarter_note;
+    uint8_t padding[4];
+};
+
+static_assert(sizeof(Header) % SectionAlignment == 0);
+static_assert(sizeof(CachedTile) % SectionAlignment == 0);
+static_assert(sizeof(CachedTempoChange) % SectionAlignment == 0);
+static_assert(sizeof(Event) % SectionAlignment == 0);
+static_assert(std::is_trivially_copyable_v<Event>);
+
+// FNV-1a, but over 64-bit words so that hashing a huge file takes a fraction of parsing it.
+uint64_t hash_contents(std::span<uint8_t const> data)
+{
+    constexpr uint64_t Prime = 0x100000001b3;
+    uint64_t hash = 0xcbf29ce484222325;
+    size_t offset = 0;
+    for (; offset + sizeof(uint64_t) <= data.size(); offset += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, data.data() + offset, sizeof(word));
+        // Rotate so that high bits of words affect the low bits of the hash too
+        hash = std::rotl((hash ^ word) * Prime, 29);
+    }
+    for (; offset < data.size(); offset++)
+        hash = (hash ^ data[offset]) * Prime;
+    return hash;
+}
+
+std::filesystem::path cache_directory()
+{
+    if (auto xdg_cache_home = getenv("XDG_CACHE_HOME"); xdg_cache_home && *xdg_cache_home)
+        return std::filesystem::path { xdg_cache_home } / "midiplayer";
+    if (auto home = getenv("HOME"); home && *home)
+        return std::filesystem::path { home } / ".cache" / "midiplayer";
+    return {};
+}
+
+template<class T>
+std::optional<std::span<T const>> read_array(ByteReader& reader, size_t count)
+{
+    if (count > SIZE_MAX / sizeof(T))
+        return {};
+    auto bytes = reader.read_bytes(count * sizeof(T));
+    if (!bytes)
+        return {};
+    reader.skip((SectionAlignment - bytes->size() % SectionAlignment) % SectionAlignment);
+    return std::span<T const> { reinterpret_cast<T const*>(bytes->data()), count };
+}
+
+template<class T>
+void write_array(std::ostream& out, std::span<T const> data)
+{
+    out.write(reinterpret_cast<char const*>(data.data()), data.size_bytes());
+    char const padding[SectionAlignment] {};
+    out.write(padding, (SectionAlignment - data.size_bytes() % SectionAlignment) % SectionAlignment);
+}
+
+}
+
+MIDIFileCache::MIDIFileCache(std::span<uint8_t const> source)
+    : m_source_hash(hash_contents(source))
+    , m_source_size(source.size())
+{
+    auto directory = cache_directory();
+    if (!directory.empty())
+        m_path = directory / fmt::format("{:016x}.cache", m_source_hash);
+}
+
+std::optional<MIDIFileCache::Contents> MIDIFileCache::load() const
+{
+    if (!is_enabled() || !std::filesystem::exists(m_path))
+        return {};
+
+    auto mapped_file = MappedFile::map(m_path);
+    if (mapped_file.is_error()) {
+        logger::warning("Failed to open cache file {}: {}", m_path, mapped_file.release_error());
+        return {};
+    }
+
+    ByteReader reader { mapped_file.value().data() };
+    auto header_data = read_array<Header>(reader, 1);
+    if (!header_data)
+        return {};
+    auto const& header = header_data->front();
+    if (memcmp(header.magic, Magic, sizeof(Magic)) != 0 || header.format_version != FormatVersion) {
+        logger::info("Ignoring cache in outdated format");
+        return {};
+    }
+    if (header.source_hash != m_source_hash || header.source_size != m_source_size)
+        return {};
+
+    auto events = read_array<Event>(reader, header.event_count);
+    if (!events || !std::ranges::is_sorted(*events, {}, &Event::tick))
+        return {};
+    // Indices below are used without further checks, so a corrupted cache must not get through.
+    auto track_indices = read_array<EventTimeline::TrackIndex>(reader, header.event_count);
+    if (!track_indices || std::ranges::any_of(*track_indices, [&](auto index) { return index >= header.track_count; }))
+        return {};
+    // Channel messages index tables over all channels, keys and controllers.
+    auto is_invalid_event = [&](Event const& event) {
+        switch (event.type()) {
+        case Event::Type::Invalid:
+        case Event::Type::EndOfTrack:
+        case Event::Type::SetTempo:
+        case Event::Type::TimeSignature:
+            return false;
+        case Event::Type::Text:
+            return event.payload_index() >= header.payload_count;
+        case Event::Type::NoteOn:
+        case Event::Type::NoteOff:
+            return event.channel() >= 16 || event.key().code() >= 128;
+        case Event::Type::ControlChange:
+            return event.channel() >= 16 || event.control_number() >= ControlChangeNumber::Count;
+        case Event::Type::ProgramChange:
+            return event.channel() >= 16;
+        }
+        return true;
+    };
+    if (std::ranges::any_of(*events, is_invalid_event))
+        return {};
+    Contents contents;
+    contents.input = std::unique_ptr<MIDIFileInput> { new MIDIFileInput };
+    auto& input = *contents.input;
+    input.m_timeline = EventTimeline {
+        { events->begin(), events->end() },
+        { track_indices->begin(), track_indices->end() },
+    };
+
+    if (header.payload_count >= SIZE_MAX / sizeof(uint64_t))
+        return {};
+    auto payload_offsets = read_array<uint64_t>(reader, header.payload_count + 1);
+    if (!payload_offsets)
+        return {};
+    auto payload_data = read_array<char>(reader, header.payload_data_size);
+    if (!payload_data)
+        return {};
+    for (size_t s = 0; s < header.payload_count; s++) {
+        auto start = (*payload_offsets)[s];
+        auto end = (*payload_offsets)[s + 1];
+        if (start > end || end > payload_data->size())
+            return {};
+        input.m_payloads.add({ payload_data->data() + start, end - start });
+    }
+
+    auto tiles = read_array<CachedTile>(reader, header.tile_count);
+    if (!tiles)
+        return {};
+    contents.tiles.reserve(tiles->size());
+    for (auto const& tile : *tiles) {
+        if (tile.channel >= 16 || tile.key >= 128)
+            return {};
+        contents.tiles.push_back(Tile {
+            tile.start_tick,
+            tile.has_end_tick ? std::optional<size_t> { tile.end_tick } : std::nullopt,
+            { tile.key, tile.channel },
+        });
+    }
+
+    auto cached_tempo_changes = read_array<CachedTempoChange>(reader, header.tempo_change_count);
+    if (!cached_tempo_changes)
+        return {};
+    std::vector<TempoMap::TempoChange> tempo_changes;
+    tempo_changes.reserve(cached_tempo_changes->size());
+    for (auto const& change : *cached_tempo_changes)
+        tempo_changes.push_back({ change.tick, change.microseconds_per_quarter_note });
+
+    input.m_valid = true;
+    input.m_header_encountered = true;
+    input.m_format = static_cast<MIDIFileFormat>(header.format);
+    input.m_is_smpte = header.is_smpte;
+    input.m_negative_smpte_format = header.negative_smpte_format;
+    input.m_ticks_per_frame = header.ticks_per_frame;
+    input.m_ticks_per_quarter_note = header.ticks_per_quarter_note;
+    input.m_end_tick = header.end_tick;
+    input.m_track_count = header.track_count;
+    input.build_tempo_map(std::move(tempo_changes));
+    input.m_keyframes.build(input.m_timeline);
+    return contents;
+}
+
+bool MIDIFileCache::store(MIDIFileInput const& input, TileWorld const& tile_world) const
+{
+    if (!is_enabled())
+        return false;
+
+    std::error_code error;
+    std::filesystem::create_directories(std::filesystem::path { m_path }.parent_path(), error);
+    if (error) {
+        logger::warning("Failed to create cache directory: {}", error.message());
+        return false;
+    }
+
+    std::vector<uint64_t> payload_offsets { 0 };
+    std::string payload_data;
+    for (size_t s = 0; s < input.m_payloads.size(); s++) {
+        payload_data += input.m_payloads.get(s);
+        payload_offsets.push_back(payload_data.size());
+    }
+
+    std::vector<CachedTile> tiles;
+    tiles.reserve(tile_world.tiles().size());
+    for (auto const& tile : tile_world.tiles()) {
+        auto end_tick = tile.end_tick();
+        tiles.push_back(CachedTile {
+            .start_tick = tile.start_tick,
+            .end_tick = end_tick.value_or(0),
+            .key = tile.transition_unit.key.code(),
+            .channel = tile.transition_unit.channel,
+            .has_end_tick = end_tick.has_value(),
+            .padding = {},
+        });
+    }
+
+    std::vector<CachedTempoChange> tempo_changes;
+    for (auto const& change : input.m_tempo_map.tempo_changes()) {
+        tempo_changes.push_back(CachedTempoChange {
+            .tick = change.tick,
+            .microseconds_per_quarter_note = change.microseconds_per_quarter_note,
+            .padding = {},
+        });
+    }
+
+    Header header {};
+    memcpy(header.magic, Magic, sizeof(Magic));
+    header.format_version = FormatVersion;
+    header.ticks_per_quarter_note = input.m_ticks_per_quarter_note;
+    header.format = static_cast<uint8_t>(input.m_format);
+    header.is_smpte = input.m_is_smpte;
+    header.negative_smpte_format = input.m_negative_smpte_format;
+    header.ticks_per_frame = input.m_ticks_per_frame;
+    header.source_hash = m_source_hash;
+    header.source_size = m_source_size;
+    header.end_tick = input.m_end_tick;
+    header.track_count = input.m_track_count;
+    header.event_count = input.m_timeline.size();
+    header.payload_count = payload_offsets.size() - 1;
+    header.payload_data_size = payload_data.size();
+    header.tile_count = tiles.size();
+    header.tempo_change_count = tempo_changes.size();
+
+    // Write to a temporary file first so that other instances never see a partially written cache.
+    auto temporary_path = m_path + ".tmp";
+    {
+        std::ofstream out { temporary_path, std::ios::binary };
+        if (out.fail()) {
+            logger::warning("Failed to open cache file {} for writing", temporary_path);
+            return false;
+        }
+        write_array<Header>(out, { &header, 1 });
+        write_array<Event>(out, input.m_timeline.events());
+        write_array<EventTimeline::TrackIndex>(out, input.m_timeline.track_indices());
+        write_array<uint64_t>(out, payload_offsets);
+        write_array<char>(out, payload_data);
+        write_array<CachedTile>(out, tiles);
+        write_array<CachedTempoChange>(out, tempo_changes);
+        if (out.fail()) {
+            logger::warning("Failed to write cache file {}", temporary_path);
+            std::filesystem::remove(temporary_path, error);
+            return false;
+        }
+    }
+
+    std::filesystem::rename(temporary_path, m_path, error);
+    if (error) {
+        logger::warning("Failed to write cache file {}: {}", m_path, error.message());
+        return false;
+    }
+    return true;
+}
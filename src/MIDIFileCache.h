@@ -0,0 +1,43 @@
+#pragma once
+
+#include "MIDIFile.h"
+#include "TileWorld.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+// On-disk cache of a decoded MIDI file and its tile layout, so that a file that
+// was already played doesn't need to be parsed and laid out again.
+//
+// Cache files are named after the content hash of the source file and live in
+// $XDG_CACHE_HOME/midiplayer (or ~/.cache/midiplayer). They are read back with
+// a single mmap; a cache that was written for different contents or by a
+// different format version is ignored and overwritten.
+class MIDIFileCache {
+public:
+    // Bump this on every change to the layout or contents of cache files.
+    static constexpr uint32_t FormatVersion = 3;
+
+    explicit MIDIFileCache(std::span<uint8_t const> source);
+
+    bool is_enabled() const { return !m_path.empty(); }
+    std::string const& path() const { return m_path; }
+
+    struct Contents {
+        std::unique_ptr<MIDIFileInput> input;
+        std::vector<Tile> tiles;
+    };
+
+    // Returns nothing if there is no up-to-date cache for the source file.
+    std::optional<Contents> load() const;
+    bool store(MIDIFileInput const&, TileWorld const&) const;
+
+private:
+    uint64_t m_source_hash {};
+    uint64_t m_source_size {};
+    std::string m_path;
+};
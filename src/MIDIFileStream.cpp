@@ -0,0 +1,139 @@
+#include "MIDIFileStream.h"
+
+#include "Logger.h"
+#include "MIDIPlayer.h"
+
+#include <algorithm>
+
+MIDIFileStreamInput::MIDIFileStreamInput(MappedFile&& file, unsigned thread_count)
+    : m_file(std::move(file))
+{
+    std::vector<TrackChunk> track_chunks;
+    m_valid = read_chunks(m_file.data(), track_chunks) && scan_tracks(track_chunks, thread_count);
+}
+
+bool MIDIFileStreamInput::scan_tracks(std::vector<TrackChunk> const& track_chunks, unsigned thread_count)
+{
+    m_streamed_tracks.resize(track_chunks.size());
+    m_decoded_tracks.resize(track_chunks.size());
+    return decode_tracks(track_chunks, thread_count, [&](size_t index, size_t& end_tick, std::vector<TempoMap::TempoChange>& tempo_changes) {
+        auto& streamed = m_streamed_tracks[index];
+        streamed.chunk = track_chunks[index];
+        TrackDecoder decoder { m_file.data(), streamed.chunk };
+        // Text is decoded again when playing, so don't keep it.
+        EventPayloads payloads;
+        // NoteOn events of held notes, paired with NoteOffs the same way as TileWorld does.
+        std::vector<std::vector<Event>> held_notes(TransitionUnit::Count);
+        for (size_t event_index = 0; !decoder.eof(); event_index++) {
+            if (event_index % CheckpointInterval == 0) {
+                Checkpoint checkpoint { decoder.state(), {} };
+                for (auto const& unit_held_notes : held_notes)
+                    checkpoint.held_notes.insert(checkpoint.held_notes.end(), unit_held_notes.begin(), unit_held_notes.end());
+                std::ranges::stable_sort(checkpoint.held_notes, {}, &Event::tick);
+                streamed.checkpoints.push_back(std::move(checkpoint));
+            }
+            auto event = decoder.read_event(payloads);
+            if (!event)
+                return false;
+            if (event->type() == Event::Type::EndOfTrack)
+                end_tick = std::max(end_tick, event->tick());
+            else if (event->type() == Event::Type::SetTempo)
+                tempo_changes.push_back({ event->tick(), event->microseconds_per_quarter_note() });
+            else if (event->type() == Event::Type::NoteOn)
+                held_notes[event->transition_unit().index()].push_back(*event);
+            else if (event->type() == Event::Type::NoteOff && !held_notes[event->transition_unit().index()].empty())
+                held_notes[event->transition_unit().index()].pop_back();
+        }
+        return true;
+    });
+}
+
+void MIDIFileStreamInput::update(MIDIPlayer& player)
+{
+    MIDIFileInput::update(player);
+
+    size_t tick = m_tick;
+    auto window = visible_ticks_with_margin(player, tick);
+    size_t window_start = tick > window.behind ? tick - window.behind : 0;
+    if (m_needs_restart) {
+        restart_decoding(player, window_start);
+        m_needs_restart = false;
+    }
+    decode_until(player, tick + window.ahead);
+
+    m_timeline.remove_events_before(window_start);
+    player.tile_world().remove_tiles_before(window_start);
+    std::optional<uint32_t> payloads_end;
+    while (!m_decoded_payloads.empty() && m_decoded_payloads.front().last_tick < window_start) {
+        payloads_end = m_decoded_payloads.front().end_index;
+        m_decoded_payloads.pop_front();
+    }
+    if (payloads_end)
+        m_payloads.remove_before(*payloads_end);
+}
+
+void MIDIFileStreamInput::seek(size_t tick)
+{
+    MIDIFileInput::seek(tick);
+    m_needs_restart = true;
+}
+
+void MIDIFileStreamInput::restart_decoding(MIDIPlayer& player, size_t tick)
+{
+    for (size_t s = 0; s < m_streamed_tracks.size(); s++) {
+        auto& streamed = m_streamed_tracks[s];
+        // Last checkpoint not after `tick`. The first one is always at the track start.
+        auto checkpoint = std::prev(std::ranges::upper_bound(streamed.checkpoints, tick, {}, [](Checkpoint const& checkpoint) { return checkpoint.state.tick; }));
+        streamed.decoder.emplace(m_file.data(), streamed.chunk, checkpoint->state);
+        streamed.held_notes = checkpoint->held_notes;
+        streamed.next_event.reset();
+        streamed.failed = false;
+    }
+    m_timeline.clear();
+    m_payloads.clear();
+    m_decoded_payloads.clear();
+    player.tile_world().clear();
+}
+
+void MIDIFileStreamInput::decode_until(MIDIPlayer& player, size_t tick)
+{
+    size_t first_new_payload = m_payloads.size();
+    for (size_t s = 0; s < m_streamed_tracks.size(); s++) {
+        auto& streamed = m_streamed_tracks[s];
+        m_decoded_tracks[s].clear();
+        for (auto const& event : streamed.held_notes)
+            m_decoded_tracks[s].add_event(event);
+        streamed.held_notes.clear();
+        while (true) {
+            if (!streamed.next_event) {
+                if (streamed.failed || streamed.decoder->eof())
+                    break;
+                streamed.next_event = streamed.decoder->read_event(m_payloads);
+                if (!streamed.next_event) {
+                    logger::error_note("in track {}", s);
+                    streamed.failed = true;
+                    break;
+                }
+            }
+            if (streamed.next_event->tick() > tick)
+                break;
+            m_decoded_tracks[s].add_event(*streamed.next_event);
+            streamed.next_event.reset();
+        }
+    }
+
+    if (m_payloads.size() > first_new_payload)
+        m_decoded_payloads.push_back({ tick, static_cast<uint32_t>(m_payloads.size()) });
+
+    // Events decoded in earlier frames are all before the new ones, so these can be just appended.
+    size_t first_new_event = m_timeline.size();
+    m_timeline.append(m_decoded_tracks);
+
+    // Build tiles in the same order as MIDIPlayer::setup does for fully decoded files.
+    auto events = m_timeline.events();
+    for (size_t s = first_new_event; s < events.size(); s++) {
+        if (events[s].is_note())
+            player.tile_world().push_note_event(events[s]);
+    }
+    player.did_read_events(events.size() - first_new_event);
+}
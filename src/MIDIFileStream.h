@@ -0,0 +1,65 @@
+#pragma once
+
+#include "MIDIFile.h"
+#include "MappedFile.h"
+
+#include <deque>
+#include <optional>
+#include <vector>
+
+// Plays a MIDI file without ever decoding it as a whole. Tracks are decoded
+// incrementally in a window around the playhead that covers the visible part
+// of the screen; events and tiles that fall behind the window are released,
+// so that memory usage doesn't depend on the length of the file.
+class MIDIFileStreamInput : public MIDIFileInput {
+public:
+    // The file is scanned once (on up to `thread_count` threads) to find the
+    // end tick and save seek checkpoints.
+    explicit MIDIFileStreamInput(MappedFile&& file, unsigned thread_count = 1);
+
+    virtual void update(MIDIPlayer&) override;
+    virtual void seek(size_t tick) override;
+    // Events before the window are not decoded, so this isn't known.
+    virtual std::optional<PlaybackState> playback_state_at(size_t) const override { return {}; }
+
+private:
+    // Decoder state is saved every that many events so that seeking
+    // doesn't need to decode tracks from the beginning.
+    static constexpr size_t CheckpointInterval = 1 << 16;
+
+    struct Checkpoint {
+        TrackDecoder::State state;
+        // NoteOn events of notes that are held at this point, so that their tiles can be built
+        // when decoding starts here.
+        std::vector<Event> held_notes;
+    };
+
+    struct StreamedTrack {
+        TrackChunk chunk;
+        std::vector<Checkpoint> checkpoints;
+        std::optional<TrackDecoder> decoder;
+        // Held notes of the checkpoint that decoding restarted from, added before any decoded event.
+        std::vector<Event> held_notes;
+        // Already decoded event that is past the window.
+        std::optional<Event> next_event;
+        bool failed = false;
+    };
+
+    // Payloads decoded by a single decode_until() call. They are freed when all events
+    // decoded by it are removed.
+    struct DecodedPayloads {
+        size_t last_tick;
+        uint32_t end_index;
+    };
+
+    bool scan_tracks(std::vector<TrackChunk> const& track_chunks, unsigned thread_count);
+    void restart_decoding(MIDIPlayer&, size_t tick);
+    void decode_until(MIDIPlayer&, size_t tick);
+
+    MappedFile m_file;
+    std::vector<StreamedTrack> m_streamed_tracks;
+    // Events decoded in the current frame, reused between frames to avoid allocating
+    std::vector<Track> m_decoded_tracks;
+    std::deque<DecodedPayloads> m_decoded_payloads;
+    bool m_needs_restart = true;
+};
@@ -3,104 +3,76 @@
 #include "Event.h"
 #include "Logger.h"
 #include "MIDIPlayer.h"
+#include "Try.h"
 
-float MIDIInput::ticks_per_second(MIDIPlayer const& player) const
+MIDIInput::TickWindow MIDIInput::visible_ticks_with_margin(MIDIPlayer const& player, size_t tick) const
 {
-    return static_cast<float>(ticks_per_quarter_note()) / player.microseconds_per_quarter_note() * 1000000;
+    size_t ticks_per_frame = m_tempo_map.microseconds_to_tick(m_tempo_map.tick_to_microseconds(tick) + 1000000.0 / player.fps()) - tick + 1;
+    return {
+        .behind = player.visible_ticks_behind() + 2 * ticks_per_frame,
+        .ahead = player.visible_ticks_ahead() + 2 * ticks_per_frame,
+    };
 }
 
-std::unique_ptr<Event> MIDIInput::read_channeled_event(std::istream& in, uint8_t type, uint8_t channel)
+std::optional<Event> MIDIInput::read_channeled_event(ByteReader& reader, uint8_t type, uint8_t channel)
 {
     switch (type) {
         case 0x80: // Note Off
         case 0x90: // Note On
         {
-            uint8_t key = 0;
-            if (!in.read((char*)&key, 1))
-                return {};
-            uint8_t velocity = 0;
-            if (!in.read((char*)&velocity, 1))
-                return {};
-            return std::make_unique<NoteEvent>(type == 0x80 || velocity == 0 ? NoteEvent::Type::Off : NoteEvent::Type::On, channel, key & 0x7f, velocity & 0x7f);
+            uint8_t key = TRY_OPTIONAL(reader.read_u8());
+            uint8_t velocity = TRY_OPTIONAL(reader.read_u8());
+            return Event::note(type == 0x90 && velocity != 0, channel, key & 0x7f, velocity & 0x7f);
         }
         case 0xa0: // Polyphonic Key Pressure (Aftertouch)
         {
-            uint8_t key = 0;
-            if (!in.read((char*)&key, 1))
-                return {};
-            uint8_t pressure = 0;
-            if (!in.read((char*)&pressure, 1))
+            // TODO
+            if (!reader.skip(2))
                 return {};
-            break; // TODO
+            break;
         }
         case 0xb0: // Control Change
         {
-            uint8_t number = 0;
-            if (!in.read((char*)&number, 1))
-                return {};
-            uint8_t value = 0;
-            if (!in.read((char*)&value, 1))
-                return {};
-            if (number >= (uint8_t)ControlChangeEvent::Number::Count) {
+            uint8_t number = TRY_OPTIONAL(reader.read_u8());
+            uint8_t value = TRY_OPTIONAL(reader.read_u8());
+            if (number >= (uint8_t)ControlChangeNumber::Count) {
                 logger::error("Invalid Control Change Number");
-                return std::make_unique<InvalidEvent>(type);
-            }
-            if (number < 0x40) {
-                return std::make_unique<LMControlChangeEvent>(channel, number & 0x20 ? LMControlChangeEvent::ByteIndex::MSB : LMControlChangeEvent::ByteIndex::LSB,
-                    static_cast<LMControlChangeEvent::Number>(number), value & 0x7f);
+                return Event::invalid(type);
             }
-            return std::make_unique<ControlChangeEvent>(channel, static_cast<ControlChangeEvent::Number>(number), value & 0x7f);
+            return Event::control_change(channel, static_cast<ControlChangeNumber>(number), value & 0x7f);
         }
         case 0xc0: // Program Change
         {
-            uint8_t program = 0;
-            if (!in.read((char*)&program, 1))
-                return {};
-            return std::make_unique<ProgramChangeEvent>(channel, program);
+            uint8_t program = TRY_OPTIONAL(reader.read_u8());
+            return Event::program_change(channel, program);
         }
         case 0xd0: // Channel Pressure (Aftertouch)
             // TODO
-            if (!in.ignore(1))
+            if (!reader.skip(1))
                 return {};
             break;
         case 0xe0: // Pitch Wheel Change
             // TODO
-            if (!in.ignore(2))
+            if (!reader.skip(2))
                 return {};
             break;
     }
-    return std::make_unique<InvalidEvent>(type);
+    return Event::invalid(type);
 }
 
-std::unique_ptr<Event> MIDIInput::read_event(std::istream& in)
+std::optional<Event> MIDIInput::read_event(ByteReader& reader)
 {
-    uint8_t status = 0;
-    if (!(in.read((char*)&status, 1))) {
+    auto status = reader.read_u8();
+    if (!status) {
         logger::error("failed to read status number");
         return {};
     }
 
     // Appendix 1.1 - Table of Major MIDI Messages
-    if (status >= 0x80 && status <= 0xef)
-        return read_channeled_event(in, status & 0xf0, status & 0x0f);
-
-    if (status != 0xfe)
-        logger::error("Invalid status number: {:#x}", (int)status);
-    return std::make_unique<InvalidEvent>(status);
-}
-
-std::vector<Event*> MIDIInput::find_events_in_range(size_t start_tick, size_t end_tick) const
-{
-    std::vector<Event*> out;
-    for (auto& track : m_tracks) {
-        auto track_out = track.find_events_in_range(start_tick, end_tick);
-        out.insert(out.begin(), track_out.begin(), track_out.end());
-    }
-
-    // Ensure that events will be played in the correct time order
-    std::stable_sort(out.begin(), out.end(), [](Event* l, Event* r) {
-        return l->tick() < r->tick();
-    });
+    if (*status >= 0x80 && *status <= 0xef)
+        return read_channeled_event(reader, *status & 0xf0, *status & 0x0f);
 
-    return out;
+    if (*status != 0xfe)
+        logger::error("Invalid status number: {:#x}", (int)*status);
+    return Event::invalid(*status);
 }
@@ -1,12 +1,14 @@
 #pragma once
 
-#include <istream>
-#include <memory>
 #include <optional>
 #include <vector>
 
+#include "ByteReader.h"
 #include "Event.h"
-#include "Track.h"
+#include "EventTimeline.h"
+#include "TempoMap.h"
+
+class MIDIPlayer;
 
 // Based on https://www.cs.cmu.edu/~music/cmsip/readings/Standard-MIDI-file-format-updated.pdf
 class MIDIInput {
@@ -20,81 +22,34 @@ public:
     virtual std::optional<size_t> end_tick() const = 0;
     virtual void update(MIDIPlayer&) { }
 
-    float ticks_per_second(MIDIPlayer const&) const;
-
-    template<class Callback>
-    void for_first_events_starting_from(size_t start, size_t max, Callback callback)
-    {
-        for (auto& track : m_tracks) {
-            size_t counter = 0;
-            auto& events = track.events();
-            for (auto it = events.lower_bound(start); it != events.end(); it++) {
-                callback(*it->second);
-                counter++;
-                if (counter >= max)
-                    break;
-            }
-        }
-    }
+    TempoMap const& tempo_map() const { return m_tempo_map; }
 
-    template<class Callback>
-    void for_first_events_starting_from_backwards(size_t start, size_t max, Callback callback)
-    {
-        for (auto& track : m_tracks) {
-            size_t counter = 0;
-            auto& events = track.events();
-            for (auto it = events.upper_bound(start); it != events.begin();) {
-                --it;
-                callback(*it->second);
-                counter++;
-                if (counter >= max)
-                    break;
-            }
-        }
-    }
+    struct TickWindow {
+        size_t behind;
+        size_t ahead;
+    };
+    // How many ticks before/after `tick` were visible in the last frame, with a margin of a few
+    // frames so that nothing that is (or is about to be) on the screen is dropped or missed.
+    TickWindow visible_ticks_with_margin(MIDIPlayer const&, size_t tick) const;
 
     template<class Callback>
     void for_each_event_in_time_order(Callback callback) const
     {
-        size_t current_tick = 0;
-        while (true) {
-            size_t min_tick = 0;
-            bool found = false;
-            for (auto& track : m_tracks) {
-                auto it = track.events().lower_bound(current_tick);
-                if (it != track.events().end() && (!found || it->first < min_tick)) {
-                    min_tick = it->first;
-                    found = true;
-                }
-            }
-            if (!found) {
-                return;
-            }
-            for (auto& track : m_tracks) {
-                auto events = track.events().equal_range(min_tick);
-                for (auto it = events.first; it != events.second; it++) {
-                    callback(*it->second);
-                }
-            }
-            current_tick = min_tick + 1;
-        }
-    }
-
-    template<class Callback>
-    void for_each_track(Callback callback)
-    {
-        for (auto& track : m_tracks)
-            callback(track);
+        for (auto const& event : m_timeline.events())
+            callback(event);
     }
 
-    std::vector<Event*> find_events_in_range(size_t start_tick, size_t end_tick) const;
+    EventTimeline& timeline() { return m_timeline; }
+    EventTimeline const& timeline() const { return m_timeline; }
 
-    Track& track(size_t index) { return m_tracks[index]; }
-    size_t track_count() const { return m_tracks.size(); }
+    EventPayloads& payloads() { return m_payloads; }
+    EventPayloads const& payloads() const { return m_payloads; }
 
 protected:
-    std::vector<Track> m_tracks;
+    EventTimeline m_timeline;
+    EventPayloads m_payloads;
+    TempoMap m_tempo_map;
 
-    std::unique_ptr<Event> read_channeled_event(std::istream& in, uint8_t type, uint8_t channel);
-    std::unique_ptr<Event> read_event(std::istream& in);
+    static std::optional<Event> read_channeled_event(ByteReader& reader, uint8_t type, uint8_t channel);
+    static std::optional<Event> read_event(ByteReader& reader);
 };
@@ -13,9 +13,11 @@
 #include <SFML/Audio.hpp>
 #include <SFML/Graphics.hpp>
 #include <SFML/Graphics/PrimitiveType.hpp>
+#include <algorithm>
 #include <cassert>
 #include <climits>
 #include <cmath>
+#include <cstdlib>
 #include <fstream>
 #include <iomanip>
 #include <random>
@@ -41,10 +43,8 @@ MIDIPlayer::~MIDIPlayer()
     if (!m_midi_output || !dynamic_cast<MIDIDeviceOutput*>(m_midi_output.get()))
         return;
     for (size_t s = 0; s < 16; s++) {
-        ControlChangeEvent c1(s, ControlChangeEvent::Number::AllSoundOff, 0);
-        m_midi_output->write_event(c1);
-        ControlChangeEvent c2(s, ControlChangeEvent::Number::AllNotesOff, 0);
-        m_midi_output->write_event(c2);
+        m_midi_output->write_event(Event::control_change(s, ControlChangeNumber::AllSoundOff, 0));
+        m_midi_output->write_event(Event::control_change(s, ControlChangeNumber::AllNotesOff, 0));
     }
     s_the = nullptr;
 }
@@ -57,26 +57,17 @@ MIDIPlayer& MIDIPlayer::the()
 
 void MIDIPlayer::run(Args const& args)
 {
-    std::unique_ptr<sf::RenderTexture> render_texture = [&]() -> std::unique_ptr<sf::RenderTexture> {
-        if (!is_headless() && args.render_to_stdout) {
-            if (isatty(STDOUT_FILENO)) {
-                logger::error("stdout is a terminal, refusing to print binary data");
-                return nullptr;
-            }
-
-            auto texture = std::make_unique<sf::RenderTexture>();
-            // TODO: Support custom resolution/FPS/format/...
-            if (!texture->resize({ 1920, 1080 })) {
-                logger::error("Failed to create render texture, ignoring");
-                return nullptr;
-            }
-            logger::info("Rendering to stdout (RGBA24 1920x1080 60fps)");
-            if (args.mode == Args::Mode::Realtime)
-                logger::warning("Realtime mode is not recommended for rendering, consider recording it to MIDI file first and playing");
-            return texture;
-        }
-        return nullptr;
-    }();
+    if (!is_headless() && (args.render_to_stdout || !args.video_output.encoder_output_path.empty())) {
+        m_video_output = VideoOutput::create(args.video_output, fps());
+        if (!m_video_output) {
+            // There is no point in playing without the video that was asked for.
+            if (!args.video_output.encoder_output_path.empty())
+                return;
+            logger::error("Failed to set up video output, ignoring");
+        } else if (args.mode == Args::Mode::Realtime)
+            logger::warning("Realtime mode is not recommended for rendering, consider recording it to MIDI file first and playing");
+    }
+    sf::RenderTexture* render_texture = m_video_output ? &m_video_output->texture() : nullptr;
 
     bool is_fullscreen = false;
     bool should_render_debug_info_in_preview = args.should_render_debug_info_in_preview;
@@ -86,14 +77,14 @@ void MIDIPlayer::run(Args const& args)
         is_fullscreen = false;
         window.emplace(sf::VideoMode::getDesktopMode(), "MIDI Player", sf::Style::Default, sf::State::Windowed, sf::ContextSettings { 0, 0, 1 });
         if (!render_texture)
-            window->setFramerateLimit(60);
+            window->setFramerateLimit(fps());
         window->setMouseCursorVisible(true);
     };
     auto create_fullscreen = [&]() {
         is_fullscreen = true;
         window.emplace(sf::VideoMode::getDesktopMode(), "MIDI Player", sf::State::Fullscreen, sf::ContextSettings { 0, 0, 1 });
         if (!render_texture)
-            window->setFramerateLimit(60);
+            window->setFramerateLimit(fps());
         window->setMouseCursorVisible(false);
     };
     if (!is_headless()) {
@@ -106,8 +97,27 @@ void MIDIPlayer::run(Args const& args)
 
     sf::Clock fps_clock;
     sf::Clock periodic_stats_clock;
+    sf::Clock preview_clock;
     sf::Time last_fps_time;
 
+    // When rendering a video, frames are rendered once at output resolution and the window shows them
+    // scaled to fit (letterboxed), less often so that it doesn't slow down rendering.
+    constexpr float PreviewFPS = 30;
+    auto preview_rect = [&]() {
+        auto window_size = sf::Vector2f { window->getSize() };
+        auto frame_size = sf::Vector2f { render_texture->getSize() };
+        float scale = std::min(window_size.x / frame_size.x, window_size.y / frame_size.y);
+        auto size = frame_size * scale;
+        return sf::FloatRect { (window_size - size) / 2.f, size };
+    };
+    auto window_to_frame_position = [&](sf::Vector2i position) {
+        if (!render_texture)
+            return sf::Vector2f { position };
+        auto rect = preview_rect();
+        float scale = rect.size.x / render_texture->getSize().x;
+        return (sf::Vector2f { position } - rect.position) / scale;
+    };
+
     std::ofstream marker_file { args.marker_file_name, std::ios::app };
     if (!args.marker_file_name.empty() && marker_file.fail())
         logger::warning("Failed to open marker file '{}'. Markers will not be saved.", args.marker_file_name);
@@ -169,15 +179,19 @@ void MIDIPlayer::run(Args const& args)
                             }
                         },
                         [&](sf::Event::MouseButtonPressed const& mouseButton) {
-                            auto rect = progress_bar_rect(sf::Vector2f(window->getSize()));
-                            if (rect.contains(sf::Vector2f { mouseButton.position })) {
-                                float fac = (mouseButton.position.x - rect.position.x) / rect.size.x;
+                            auto frame_size = render_texture ? sf::Vector2f(render_texture->getSize()) : sf::Vector2f(window->getSize());
+                            auto rect = progress_bar_rect(frame_size);
+                            auto position = window_to_frame_position(mouseButton.position);
+                            if (rect.contains(position)) {
+                                float fac = (position.x - rect.position.x) / rect.size.x;
                                 assert(fac >= 0 && fac <= 1);
                                 auto input = dynamic_cast<MIDIFileInput*>(midi_input());
                                 if (input) {
                                     auto end_tick = input->end_tick();
                                     assert(end_tick);
-                                    seek(fac * *end_tick);
+                                    // The progress bar is linear in time, not in ticks
+                                    auto const& tempo_map = input->tempo_map();
+                                    seek(tempo_map.seconds_to_tick(fac * tempo_map.tick_to_seconds(*end_tick)));
                                 }
                             }
                         },
@@ -189,16 +203,31 @@ void MIDIPlayer::run(Args const& args)
         update();
         if (!is_headless()) {
             // FIXME: Last FPS should be stored in MIDIPlayer somehow!
-            render(*window, { .full_info = should_render_debug_info_in_preview, .last_fps_time = last_fps_time });
-            window->display();
-
+            DebugInfo preview_debug_info { .full_info = should_render_debug_info_in_preview, .last_fps_time = last_fps_time };
             if (render_texture) {
                 render(*render_texture, { .full_info = false, .last_fps_time = last_fps_time });
                 render_texture->display();
-                auto image = render_texture->getTexture().copyToImage();
-
-                // NOTE: RGBA only!
-                fwrite(image.getPixelsPtr(), 4, image.getSize().x * image.getSize().y, stdout);
+                m_video_output->write_frame();
+                if (m_video_output->failed())
+                    set_playing(false);
+
+                if (preview_clock.getElapsedTime() >= sf::seconds(1 / PreviewFPS)) {
+                    preview_clock.restart();
+                    auto window_size = sf::Vector2f { window->getSize() };
+                    window->setView(sf::View { sf::FloatRect { { 0, 0 }, window_size } });
+                    window->clear();
+                    auto rect = preview_rect();
+                    sf::Sprite preview { render_texture->getTexture() };
+                    preview.setPosition(rect.position);
+                    preview.setScale(sf::Vector2f { rect.size.x / render_texture->getSize().x, rect.size.y / render_texture->getSize().y });
+                    window->draw(preview);
+                    if (preview_debug_info.full_info)
+                        render_debug_info(*window, preview_debug_info);
+                    window->display();
+                }
+            } else {
+                render(*window, preview_debug_info);
+                window->display();
             }
         } else {
             sf::sleep(sf::seconds(1.f / fps()) - fps_clock.getElapsedTime());
@@ -210,6 +239,10 @@ void MIDIPlayer::run(Args const& args)
             std::cout << get_stats_string(true) << std::endl;
         }
     }
+    if (m_video_output) {
+        m_video_output->finish();
+        m_video_output.reset();
+    }
     write_marker("end");
 }
 
@@ -255,18 +288,19 @@ void MIDIPlayer::setup()
             logger::info("Font loaded");
 
         if (m_render_resources->pedals_texture.loadFromFile(resource_path + "/pedals.png")
-            && m_render_resources->smoke_texture.loadFromFile(resource_path + "/smoke.png")) {
+            && m_render_resources->smoke_texture.loadFromFile(resource_path + "/smoke.png")
+            && m_render_resources->transition_color_texture.resize({ 128, 16 })) {
             logger::info("Textures loaded");
         } else {
             exit(1);
         }
     }
 
-    if (!real_time()) {
-        m_midi_input->for_each_event_in_time_order([&](auto const& event) {
-            if (dynamic_cast<NoteEvent const*>(&event)) {
-                m_tile_world.push_note_event(static_cast<NoteEvent const&>(event));
-            }
+    // The tiles may be already loaded from cache
+    if (!real_time() && m_tile_world.tiles().empty()) {
+        m_midi_input->for_each_event_in_time_order([&](Event const& event) {
+            if (event.is_note())
+                m_tile_world.push_note_event(event);
         });
     }
 
@@ -274,8 +308,7 @@ void MIDIPlayer::setup()
     if (!m_midi_output || !dynamic_cast<MIDIDeviceOutput*>(m_midi_output.get()))
         return;
     for (size_t s = 0; s < 16; s++) {
-        ControlChangeEvent c1(s, ControlChangeEvent::Number::ResetAllControllers, 0);
-        m_midi_output->write_event(c1);
+        m_midi_output->write_event(Event::control_change(s, ControlChangeNumber::ResetAllControllers, 0));
     }
 }
 
@@ -285,55 +318,102 @@ void MIDIPlayer::start_timer()
     m_in_loop = true;
 }
 
-sf::Color MIDIPlayer::resolve_color(Tile const& event) const
+sf::Color MIDIPlayer::resolve_color(Tile const& tile) const
+{
+    if (auto color = static_color(tile))
+        return *color;
+    return m_tile_color_table[tile.transition_unit.channel][tile.transition_unit.key].color;
+}
+
+std::optional<sf::Color> MIDIPlayer::static_color(Tile const& tile) const
 {
-    for (auto const& selector_list : m_static_tile_colors) {
-        for (auto const& selector : selector_list.first) {
-            if (selector->matches(event.transition_unit, &event))
-                return selector_list.second;
+    update_tile_color_table();
+    auto const& entry = m_tile_color_table[tile.transition_unit.channel][tile.transition_unit.key];
+    size_t matched_rule = entry.rule;
+    if (entry.depends_on_tile) {
+        // Only rules before entry.rule can give a different result, and it never changes for a tile.
+        if (tile.color_rule_version != m_static_tile_colors_version) {
+            tile.color_rule = entry.rule;
+            for (size_t rule = 0; rule < entry.rule; rule++) {
+                if (m_static_tile_colors[rule].first.matches(tile.transition_unit, &tile)) {
+                    tile.color_rule = rule;
+                    break;
+                }
+            }
+            tile.color_rule_version = m_static_tile_colors_version;
         }
+        matched_rule = tile.color_rule;
     }
+    if (matched_rule < m_static_tile_colors.size())
+        return m_static_tile_colors[matched_rule].second;
+    return {};
+}
 
-    auto maybe_pending_transition = m_note_transitions.find(event.transition_unit);
-    if (maybe_pending_transition != m_note_transitions.end())
-        return maybe_pending_transition->second;
-
-    return m_config.default_color();
+sf::Texture const& MIDIPlayer::transition_color_texture() const
+{
+    auto& resources = *m_render_resources;
+    if (resources.transition_color_texture_version != m_tile_colors_version) {
+        // Colors are indexed by TransitionUnit::index(), which makes rows of keys for every channel.
+        static_assert(sizeof(sf::Color) == 4);
+        m_note_transitions.blend(m_config.default_color(), resources.transition_colors);
+        resources.transition_color_texture.update(reinterpret_cast<uint8_t const*>(resources.transition_colors.data()));
+        resources.transition_color_texture_version = m_tile_colors_version;
+    }
+    return resources.transition_color_texture;
 }
 
-void MIDIPlayer::update_note_transitions(Config::SelectorList const& selectors, sf::Color color, double transition)
+void MIDIPlayer::update_tile_color_table() const
 {
-    // FIXME: Very naive and not the best.
-    for (uint8_t key = 0; key < 128; key++) {
-        for (uint8_t channel = 0; channel < 16; channel++) {
-            NoteEvent::TransitionUnit transition_unit { key, channel };
-            bool matches = false;
-            if (selectors.empty())
-                matches = true;
-            else {
-                for (auto& selector : selectors) {
-                    if (selector->matches(transition_unit, nullptr)) {
-                        matches = true;
+    if (m_tile_color_table_version == m_tile_colors_version)
+        return;
+
+    // Transitions change much more often than rules (e.g every frame when animating),
+    // so rules are matched again only if they changed.
+    bool rules_changed = m_tile_color_table_rules_version != m_static_tile_colors_version;
+    NoteTransitions::Colors transition_colors;
+    m_note_transitions.blend(m_config.default_color(), transition_colors);
+    for (uint8_t channel = 0; channel < 16; channel++) {
+        for (uint8_t key = 0; key < 128; key++) {
+            TransitionUnit transition_unit { key, channel };
+            auto& entry = m_tile_color_table[channel][key];
+            if (rules_changed) {
+                entry.rule = m_static_tile_colors.size();
+                entry.depends_on_tile = false;
+                for (size_t rule = 0; rule < m_static_tile_colors.size(); rule++) {
+                    auto const& selectors = m_static_tile_colors[rule].first;
+                    if (selectors.unit_mask()[transition_unit.index()]) {
+                        entry.rule = rule;
                         break;
                     }
+                    if (selectors.depends_on_tile())
+                        entry.depends_on_tile = true;
                 }
             }
-            if (!matches)
-                continue;
-
-            auto maybe_pending_transition = m_note_transitions.find(transition_unit);
-            if (maybe_pending_transition != m_note_transitions.end())
-                maybe_pending_transition->second.set_value_with_factor(color, transition);
-            Config::AnimatableProperty<sf::Color> color_animatable { std::move(color) };
-            color_animatable.set_value_with_factor(color, transition);
-            m_note_transitions.insert(std::make_pair(transition_unit, std::move(color_animatable)));
+
+            if (entry.rule < m_static_tile_colors.size())
+                entry.color = m_static_tile_colors[entry.rule].second;
+            else
+                entry.color = transition_colors[transition_unit.index()];
         }
     }
+    m_tile_color_table_version = m_tile_colors_version;
+    m_tile_color_table_rules_version = m_static_tile_colors_version;
+}
+
+void MIDIPlayer::update_note_transitions(Config::SelectorList const& selectors, sf::Color color, double transition)
+{
+    invalidate_tile_colors();
+    auto units = selectors.unit_mask();
+    if (selectors.empty())
+        units.set();
+    m_note_transitions.set_color(units, color, transition);
 }
 
 void MIDIPlayer::add_static_tile_color(Config::SelectorList const& selectors, sf::Color color)
 {
     m_static_tile_colors.push_back({ selectors, color });
+    m_static_tile_colors_version++;
+    invalidate_tile_colors();
 }
 
 bool MIDIPlayer::load_config_file(std::string const& path)
@@ -348,6 +428,7 @@ bool MIDIPlayer::reload_config_file()
     if (!m_headless)
         assert(m_render_resources);
     bool success = m_config.reload(m_config_file_path);
+    invalidate_tile_colors();
 
     if (!m_headless) {
         generate_dust_texture();
@@ -366,7 +447,7 @@ bool MIDIPlayer::reload_config_file()
     }
 
     if (m_real_time) {
-        m_midi_input->for_each_track([this](Track& trk) { trk.set_max_events(config().max_events_per_track()); });
+        m_midi_input->timeline().set_max_events(config().max_events_per_track());
     }
     if (!success)
         return false;
@@ -409,19 +490,19 @@ void MIDIPlayer::generate_minimap_texture()
     }
 
     auto& input = *static_cast<MIDIFileInput*>(m_midi_input.get());
+    auto const& tempo_map = input.tempo_map();
+    double total_seconds = tempo_map.tick_to_seconds(*input.end_tick());
     sf::VertexArray varr(sf::PrimitiveType::Lines);
-    input.for_each_track([&](Track const& track) {
-        for (auto const& event : track.events()) {
-            if (auto note_event = dynamic_cast<NoteEvent*>(event.second.get())) {
-                auto tick_to_position = [&](size_t tick) {
-                    float position_x = (float)tick / *input.end_tick() * target.getSize().x;
-                    float position_y = (note_event->key().to_piano_position() - view_offset_x) / view_size_x * target.getSize().y;
-                    return sf::Vector2f { position_x, position_y };
-                };
-
-                auto pos = tick_to_position(event.first);
-                varr.append(sf::Vertex(pos, sf::Color { 255, 255, 255, 200 }));
-            }
+    input.for_each_event_in_time_order([&](Event const& event) {
+        if (event.is_note()) {
+            auto tick_to_position = [&](size_t tick) {
+                float position_x = tempo_map.tick_to_seconds(tick) / total_seconds * target.getSize().x;
+                float position_y = (event.key().to_piano_position() - view_offset_x) / view_size_x * target.getSize().y;
+                return sf::Vector2f { position_x, position_y };
+            };
+
+            auto pos = tick_to_position(event.tick());
+            varr.append(sf::Vertex(pos, sf::Color { 255, 255, 255, 200 }));
         }
     });
     target.draw(varr);
@@ -448,12 +529,9 @@ bool MIDIPlayer::current_time_is(Config::Time time, size_t offset_in_frames) con
 {
     switch (time.unit()) {
         case Config::Time::Unit::Ticks: {
-            // FIXME: This should have its converter function
-            auto ticks_per_frame = m_midi_input->ticks_per_second(*this) / fps();
-            auto offset_in_ticks = offset_in_frames * ticks_per_frame;
-            auto tick_start_frame = time.value() + offset_in_ticks;
-            auto diff = time.value() + offset_in_ticks - current_tick();
-            return std::abs(time.value() + offset_in_ticks - current_tick()) < ticks_per_frame;
+            auto const& tempo_map = m_midi_input->tempo_map();
+            auto frame = tempo_map.tick_to_seconds(time.value()) * fps() + offset_in_frames;
+            return std::abs(frame - tempo_map.tick_to_seconds(current_tick()) * fps()) < 1;
         }
         case Config::Time::Unit::Frames:
             return current_frame() == time.value() + offset_in_frames;
@@ -480,11 +558,8 @@ bool MIDIPlayer::is_in_interval_frame(Config::Time interval, size_t offset_in_fr
 size_t MIDIPlayer::frame_count_for_time(Config::Time time, size_t offset_in_frames) const
 {
     switch (time.unit()) {
-        case Config::Time::Unit::Ticks: {
-            // FIXME: This should have its converter function
-            auto ticks_per_frame = m_midi_input->ticks_per_second(*this) / fps();
-            return time.value() / ticks_per_frame + offset_in_frames;
-        }
+        case Config::Time::Unit::Ticks:
+            return m_midi_input->tempo_map().tick_to_seconds(time.value()) * fps() + offset_in_frames;
         case Config::Time::Unit::Frames:
             return time.value() + offset_in_frames;
         case Config::Time::Unit::Seconds:
@@ -500,9 +575,84 @@ void MIDIPlayer::reset_midi()
     }
     for (int i = 0; i < 16; i++) {
         // Silence all sounds
-        m_midi_output->write_event(ControlChangeEvent(i, ControlChangeEvent::Number::AllSoundOff, 0));
+        m_midi_output->write_event(Event::control_change(i, ControlChangeNumber::AllSoundOff, 0));
         // Clear pedal state etc.
-        m_midi_output->write_event(ControlChangeEvent(i, ControlChangeEvent::Number::ResetAllControllers, 0));
+        m_midi_output->write_event(Event::control_change(i, ControlChangeNumber::ResetAllControllers, 0));
+    }
+}
+
+void MIDIPlayer::restore_playback_state(PlaybackState const& state)
+{
+    m_pedals = state.pedals();
+    for (auto& note : m_notes)
+        note.is_played = false;
+    for (MIDIChannel channel = 0; channel < PlaybackState::ChannelCount; channel++) {
+        for (size_t key = 0; key < PlaybackState::KeyCount; key++) {
+            if (auto velocity = state.note_velocity(channel, key); velocity > 0)
+                set_sound_playing(key, velocity, true, resolve_color(Tile { m_current_tick, {}, { key, channel } }));
+        }
+    }
+
+    // Notes held across the seek point need to sound. Files don't need this, as they are written sequentially anyway.
+    if (!dynamic_cast<MIDIDeviceOutput*>(m_midi_output.get()) || m_real_time)
+        return;
+    for (auto const& event : state.restoring_events()) {
+        m_events_written++;
+        m_midi_output->write_event(event);
+    }
+}
+
+void MIDIPlayer::execute_event(Event const& event)
+{
+    switch (event.type()) {
+        case Event::Type::NoteOn:
+        case Event::Type::NoteOff:
+            if (real_time())
+                m_tile_world.push_note_event(event);
+            set_sound_playing(event.key(), event.velocity(), event.type() == Event::Type::NoteOn,
+                resolve_color(Tile { event.tick(), {}, event.transition_unit() }));
+            break;
+        case Event::Type::ControlChange:
+            switch (event.control_number()) {
+                case ControlChangeNumber::DamperPedal:
+                    m_pedals.set_sustain(event.control_value() > 0);
+                    break;
+                case ControlChangeNumber::Sostenuto:
+                    m_pedals.set_sostenuto(event.control_value() > 0);
+                    break;
+                case ControlChangeNumber::SoftPedal:
+                    m_pedals.set_soft(event.control_value() > 0);
+                    break;
+                default:
+                    // TODO
+                    break;
+            }
+            break;
+        case Event::Type::SetTempo:
+            // Already accounted for by the tempo map of the input
+            break;
+        case Event::Type::Text:
+            switch (event.text_type()) {
+                case Event::TextType::TrackName:
+                    display_label(LabelType::TrackName, std::string { m_midi_input->payloads().get(event.payload_index()) }, 180);
+                    break;
+                case Event::TextType::Lyric:
+                case Event::TextType::Text:
+                case Event::TextType::Copyright:
+                case Event::TextType::Instrument:
+                case Event::TextType::Marker:
+                case Event::TextType::CuePoint:
+                    // TODO
+                    break;
+            }
+            break;
+        case Event::Type::TimeSignature:
+        case Event::Type::ProgramChange:
+            // TODO
+            break;
+        case Event::Type::Invalid:
+        case Event::Type::EndOfTrack:
+            break;
     }
 }
 
@@ -512,6 +662,8 @@ void MIDIPlayer::seek(size_t tick)
     if (input) {
         input->seek(tick);
         m_current_tick = tick;
+        m_playhead.seek(tick);
+        m_state_after_seek = input->playback_state_at(tick);
         m_seeked_in_previous_frame = true;
     }
 }
@@ -519,7 +671,6 @@ void MIDIPlayer::seek(size_t tick)
 void MIDIPlayer::update()
 {
     if (!is_paused()) {
-        auto previous_current_tick = m_current_tick;
         m_midi_input->update(*this);
         m_current_tick = calculate_current_tick();
 
@@ -527,29 +678,30 @@ void MIDIPlayer::update()
             reload_config_file();
 
         m_config.update();
-        auto events = m_midi_input->find_events_in_range(previous_current_tick, m_current_tick);
+        // NOTE: This must be after updating config, as actions can add events.
+        auto events = m_playhead.advance_to(m_midi_input->timeline(), m_current_tick);
 
         m_events_executed += events.size();
 
         if (m_seeked_in_previous_frame) {
             reset_midi();
-            m_pedals = Pedals();
-            for (auto& note : m_notes) {
-                note.is_played = false;
-            }
+            restore_playback_state(m_state_after_seek.value_or(PlaybackState {}));
+            m_state_after_seek.reset();
             m_seeked_in_previous_frame = false;
         }
 
         for (auto const& event : events) {
-            event->execute(*this);
+            execute_event(event);
             if (m_midi_output) {
                 m_events_written++;
-                m_midi_output->write_event(*event);
+                m_midi_output->write_event(event);
             }
         }
 
     } else {
         m_current_tick = calculate_current_tick();
+        // Events that became due while paused are not played
+        m_playhead.seek(m_current_tick);
     }
 
     auto all_particles = { std::views::all(m_dust_particles), std::views::all(m_smoke_particles) };
@@ -595,11 +747,159 @@ Util::Vector2f MIDIPlayer::get_turbulence_at(Util::Point2f point) const
     return (base + up_factor).normalized() * 0.002;
 }
 
+sf::RenderTexture* MIDIPlayer::frame_buffer(sf::Vector2u size)
+{
+    auto& buffers = m_render_resources->frame_buffers;
+    // Buffers that were not used in the previous frame are of a size from before resizing.
+    std::erase_if(buffers, [&](auto const& buffer) { return buffer.second.last_used_frame + 1 < m_current_frame; });
+
+    auto [buffer, inserted] = buffers.try_emplace({ size.x, size.y });
+    if (inserted && !buffer->second.texture.resize(size)) {
+        buffers.erase(buffer);
+        return nullptr;
+    }
+    buffer->second.last_used_frame = m_current_frame;
+    return &buffer->second.texture;
+}
+
 void MIDIPlayer::render_notes(sf::RenderTarget& target) const
 {
     m_tile_world.render(target, *this);
 }
 
+void MIDIPlayer::render_notes_incrementally(sf::RenderTarget& target)
+{
+    // In play mode tiles only scroll down between frames, so the tile layer of the previous frame is
+    // moved by whole pixels, and only tiles in the strip of pixels that it uncovered are drawn, along
+    // with columns of keys whose tiles changed.
+    auto& layer = m_render_resources->tile_layer;
+    auto size = target.getSize();
+    auto view = target.getView();
+    auto pixels_per_unit = sf::Vector2f { size.x / view.getSize().x, size.y / view.getSize().y };
+
+    // Tiles are drawn as if the current tick was at a whole pixel, so that parts drawn in different frames line up.
+    double position = current_tick() * scale() * pixels_per_unit.y;
+    auto scroll = std::llround(position);
+    view.move({ 0, static_cast<float>((position - scroll) / pixels_per_unit.y) });
+
+    RenderResources::TileLayer::Key key { size, scale(), static_tile_colors_version(), config().tile_merge_threshold() };
+    if (layer.key != key) {
+        for (auto& texture : layer.textures) {
+            if (!texture.resize(size)) {
+                logger::error("Failed to create tile layer");
+                layer.key.reset();
+                render_notes(target);
+                return;
+            }
+        }
+        layer.key = key;
+        // Force a full redraw
+        layer.scroll = scroll - size.y;
+    }
+
+    auto shift = scroll - layer.scroll;
+    bool full_redraw = std::llabs(shift) >= size.y;
+
+    // Tiles with no end tick grow every frame, and tiles of units whose transition color changed
+    // need to be drawn again too.
+    transition_color_texture();
+    auto const& transition_colors = m_render_resources->transition_colors;
+    auto changed_keys = m_tile_world.keys_with_pending_tiles();
+    for (size_t unit = 0; unit < TransitionUnit::Count; unit++) {
+        if (transition_colors[unit] != layer.transition_colors[unit])
+            changed_keys.set(unit % 128);
+    }
+    layer.transition_colors = transition_colors;
+
+    // Pixel columns of changed keys, merged where they overlap.
+    std::vector<std::pair<int, int>> changed_columns;
+    float view_left = view.getCenter().x - view.getSize().x / 2;
+    for (size_t key = 0; key < 128 && !full_redraw; key++) {
+        if (!changed_keys[key])
+            continue;
+        auto [left, right] = TileWorld::key_x_range(static_cast<uint8_t>(key));
+        int left_px = std::clamp<float>(std::floor((left - view_left) * pixels_per_unit.x), 0, size.x);
+        int right_px = std::clamp<float>(std::ceil((right - view_left) * pixels_per_unit.x), 0, size.x);
+        if (left_px < right_px)
+            changed_columns.push_back({ left_px, right_px });
+    }
+    std::ranges::sort(changed_columns);
+    size_t merged_count = 0;
+    size_t changed_width = 0;
+    for (auto const& column : changed_columns) {
+        if (merged_count > 0 && column.first <= changed_columns[merged_count - 1].second) {
+            auto& last = changed_columns[merged_count - 1];
+            changed_width += std::max(last.second, column.second) - last.second;
+            last.second = std::max(last.second, column.second);
+            continue;
+        }
+        changed_width += column.second - column.first;
+        changed_columns[merged_count++] = column;
+    }
+    changed_columns.resize(merged_count);
+    // Then it's cheaper to draw everything at once.
+    if (changed_width >= size.x / 2)
+        full_redraw = true;
+
+    auto& front = layer.textures[layer.front];
+    auto& back = layer.textures[1 - layer.front];
+    back.clear(sf::Color::Transparent);
+    sf::View pixel_view { sf::FloatRect { { 0, 0 }, sf::Vector2f { size } } };
+    // Draw tiles clipped to `pixels`, with the same scale as the whole layer.
+    auto render_tiles_in = [&](sf::FloatRect pixels) {
+        sf::View clipped_view = view;
+        clipped_view.setSize({ pixels.size.x / pixels_per_unit.x, pixels.size.y / pixels_per_unit.y });
+        auto center = pixels.position + pixels.size / 2.f;
+        clipped_view.setCenter({ view_left + center.x / pixels_per_unit.x, view.getCenter().y - view.getSize().y / 2 + center.y / pixels_per_unit.y });
+        clipped_view.setViewport(sf::FloatRect { { pixels.position.x / size.x, pixels.position.y / size.y }, { pixels.size.x / size.x, pixels.size.y / size.y } });
+        back.setView(clipped_view);
+        m_tile_world.render(back, *this);
+    };
+
+    layer.redrawn_rows = 0;
+    layer.redrawn_columns = 0;
+    if (full_redraw) {
+        back.setView(view);
+        m_tile_world.render(back, *this);
+        layer.redrawn_rows = size.y;
+        layer.redrawn_columns = size.x;
+    } else if (shift != 0 || !changed_columns.empty()) {
+        back.setView(pixel_view);
+        sf::Sprite previous { front.getTexture() };
+        previous.setPosition({ 0, static_cast<float>(shift) });
+        back.draw(previous, sf::BlendNone);
+
+        if (shift != 0) {
+            float strip_top = shift > 0 ? 0 : size.y + shift;
+            float strip_height = std::llabs(shift);
+            render_tiles_in({ { 0, strip_top }, { static_cast<float>(size.x), strip_height } });
+            layer.redrawn_rows = strip_height;
+        }
+        for (auto [left, right] : changed_columns) {
+            sf::FloatRect pixels { { static_cast<float>(left), 0 }, { static_cast<float>(right - left), static_cast<float>(size.y) } };
+            back.setView(pixel_view);
+            sf::RectangleShape clear_rect { pixels.size };
+            clear_rect.setPosition(pixels.position);
+            clear_rect.setFillColor(sf::Color::Transparent);
+            back.draw(clear_rect, sf::BlendNone);
+            render_tiles_in(pixels);
+        }
+        layer.redrawn_columns = changed_width;
+    }
+    if (full_redraw || shift != 0 || !changed_columns.empty()) {
+        back.display();
+        layer.front = 1 - layer.front;
+        layer.scroll = scroll;
+    }
+
+    // Colors in the layer are premultiplied by alpha, as it is blended onto a transparent texture.
+    auto previous_view = target.getView();
+    target.setView(pixel_view);
+    target.draw(sf::Sprite { layer.textures[layer.front].getTexture() },
+        sf::BlendMode { sf::BlendMode::Factor::One, sf::BlendMode::Factor::OneMinusSrcAlpha });
+    target.setView(previous_view);
+}
+
 void MIDIPlayer::render_particles(sf::RenderTarget& target) const
 {
     if (!m_smoke_particles.empty()) {
@@ -804,6 +1104,10 @@ void MIDIPlayer::render_debug_info(sf::RenderTarget& target, DebugInfo const& de
     oss << std::to_string(1.f / debug_info.last_fps_time.asSeconds()) + " fps\n";
     oss << "Particles: dust=" << m_dust_particles.size() << " smoke=" << m_smoke_particles.size() << std::endl;
     oss << "StaticTileColors: " << m_static_tile_colors.size() << std::endl;
+    oss << "Tiles: total=" << m_tile_world.tiles().size() << " pending=" << m_tile_world.pending_tile_count()
+        << " chunks=" << m_tile_world.resident_chunk_count() << std::endl;
+    if (config().incremental_tiles() && !real_time())
+        oss << "TileLayer: redrawn_rows=" << m_render_resources->tile_layer.redrawn_rows << " redrawn_columns=" << m_render_resources->tile_layer.redrawn_columns << std::endl;
     m_config.dump_stats(oss);
 
     sf::Text text { m_render_resources->debug_font, oss.str(), 10 };
@@ -832,8 +1136,9 @@ void MIDIPlayer::render_progress_bar(sf::RenderTarget& target) const
         auto rect = progress_bar_rect(sf::Vector2f(target.getSize()));
         sf::Vector2f size = rect.size;
         sf::Vector2f position = rect.position;
-        float current_time = (double)current_tick() / m_midi_input->ticks_per_second(*this);
-        float total_time = m_midi_input->end_tick().value() / m_midi_input->ticks_per_second(*this);
+        auto const& tempo_map = m_midi_input->tempo_map();
+        float current_time = tempo_map.tick_to_seconds(current_tick());
+        float total_time = tempo_map.tick_to_seconds(m_midi_input->end_tick().value());
 
         RoundedEdgeRectangleShape rect_drawable { rect.size, size.y / 2 };
         rect_drawable.setPosition(position);
@@ -869,7 +1174,7 @@ void MIDIPlayer::render_progress_bar(sf::RenderTarget& target) const
         });
         target.draw(text_right);
     } else {
-        sf::Text text { m_render_resources->display_font, pretty_time((double)current_tick() / m_midi_input->ticks_per_second(*this)), 14 };
+        sf::Text text { m_render_resources->display_font, pretty_time(m_midi_input->tempo_map().tick_to_seconds(current_tick())), 14 };
         text.setPosition({ std::floor(target_size.x / 2.f - text.getLocalBounds().size.x / 2.f), 10 });
         target.draw(text);
 
@@ -919,20 +1224,23 @@ std::string MIDIPlayer::get_stats_string(bool) const
 {
     auto tick = current_tick();
     auto end_tick = m_midi_input->end_tick();
+    auto const& tempo_map = m_midi_input->tempo_map();
 
     std::ostringstream oss;
-    auto elapsed_seconds = (double)tick / m_midi_input->ticks_per_second(*this);
+    auto elapsed_seconds = tempo_map.tick_to_seconds(tick);
     oss << pretty_time(elapsed_seconds);
     oss << " (Tick=" << tick << " Frame=" << current_frame() << " Second=" << std::fixed << std::setprecision(2) << elapsed_seconds << ")";
 
     if (!m_real_time && end_tick.has_value()) {
         oss << " / ";
-        oss << pretty_time(end_tick.value() / m_midi_input->ticks_per_second(*this));
+        oss << pretty_time(tempo_map.tick_to_seconds(end_tick.value()));
         oss << " (Ticks=" << end_tick.value() << ")";
         oss << " (" << 100 * tick / end_tick.value() << "%)";
     }
 
     oss << "  " << m_events_read << "R " << m_events_written << "W " << m_events_executed << "X";
+    if (m_video_output)
+        oss << "  " << m_video_output->stats_string();
     return oss.str();
 }
 
@@ -987,12 +1295,16 @@ void MIDIPlayer::render(sf::RenderTarget& target, DebugInfo const& debug_info)
     float aspect = static_cast<float>(target.getSize().x) / target.getSize().y;
     const float piano_size = MIDIPlayer::piano_size_px * (MIDIPlayer::view_size_x / aspect) / target.getSize().y;
     auto piano_view = sf::View { sf::FloatRect({ MIDIPlayer::view_offset_x, -MIDIPlayer::view_size_x / aspect + piano_size }, { MIDIPlayer::view_size_x, MIDIPlayer::view_size_x / aspect }) };
+    // Tiles are 1 unit per tick (times scale) in the piano view, playhead at 0.
+    m_visible_ticks_ahead = (MIDIPlayer::view_size_x / aspect - piano_size) / scale() + 1;
+    m_visible_ticks_behind = piano_size / scale() + 1;
 
     do {
-        sf::RenderTexture tmp_buffer;
-        if (!tmp_buffer.resize({ target.getSize().x, target.getSize().y })) {
+        auto maybe_tmp_buffer = frame_buffer(target.getSize());
+        if (!maybe_tmp_buffer) {
             break;
         }
+        auto& tmp_buffer = *maybe_tmp_buffer;
         tmp_buffer.clear(config().background_color());
         render_background(tmp_buffer);
         tmp_buffer.setView(piano_view);
@@ -1004,7 +1316,10 @@ void MIDIPlayer::render(sf::RenderTarget& target, DebugInfo const& debug_info)
             }
         }
 
-        render_notes(tmp_buffer);
+        if (config().incremental_tiles() && !real_time())
+            render_notes_incrementally(tmp_buffer);
+        else
+            render_notes(tmp_buffer);
         render_particles(tmp_buffer);
 
         target.setView(sf::View { sf::FloatRect {
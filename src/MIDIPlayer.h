@@ -2,12 +2,16 @@
 
 #include "Config/Property.h"
 #include "Event.h"
+#include "EventTimeline.h"
 #include "FileWatcher.h"
 #include "MIDIOutput.h"
 #include "MIDIPlayerConfig.h"
+#include "NoteTransitions.h"
 #include "Pedals.hpp"
+#include "PlaybackState.h"
 #include "TileWorld.hpp"
 #include "Utils/PerlinNoise.hpp"
+#include "VideoOutput.h"
 #include <SFML/Graphics.hpp>
 #include <SFML/Graphics/RenderTarget.hpp>
 #include <SFML/System/Vector2.hpp>
@@ -61,6 +65,8 @@ public:
         };
         Mode mode {};
         bool render_to_stdout = false;
+        // Used when rendering to stdout or encoding.
+        VideoOutput::Settings video_output;
         bool should_render_debug_info_in_preview = false;
         bool force_overwrite = false;
         bool remove_file_if_nothing_written = false;
@@ -84,7 +90,6 @@ public:
     bool is_headless() const { return m_headless; }
     void set_fps(unsigned fps) { m_fps = fps; }
     unsigned fps() const { return m_fps; }
-    void set_tempo(uint32_t microseconds_per_quarter_note) { m_microseconds_per_quarter_note = microseconds_per_quarter_note; }
     void set_sound_playing(int index, int velocity, bool playing, sf::Color color);
     void stop() { m_playing = false; }
     void set_paused(bool b) { m_paused = b; }
@@ -104,9 +109,12 @@ public:
     bool is_in_interval_frame(Config::Time, size_t offset_in_frames) const;
     size_t frame_count_for_time(Config::Time time, size_t offset_in_frames) const;
     auto start_time() const { return m_start_time; }
-    auto microseconds_per_quarter_note() const { return m_microseconds_per_quarter_note; }
     bool is_in_loop() const { return m_in_loop; }
 
+    // How many ticks after/before the current tick were visible in the last rendered frame.
+    size_t visible_ticks_ahead() const { return m_visible_ticks_ahead; }
+    size_t visible_ticks_behind() const { return m_visible_ticks_behind; }
+
     void spawn_particle(Particle::Type, Particle&&);
     void spawn_random_particles(sf::RenderTarget& target, MIDIKey key, sf::Color color, int velocity);
 
@@ -128,8 +136,17 @@ public:
     int particle_count() const { return m_config.particle_count(); }
     double scale() const { return m_config.scale(); }
     sf::Color resolve_color(Tile const&) const;
+    // Color of `tile` from a static rule (tile_color), or nothing if it's the color of its transition unit.
+    std::optional<sf::Color> static_color(Tile const&) const;
+    // Changes every time the result of static_color() may change.
+    uint32_t static_tile_colors_version() const { return m_static_tile_colors_version; }
+    // Current colors of transition units, as a 128x16 (key x channel) texture.
+    sf::Texture const& transition_color_texture() const;
     void update_note_transitions(Config::SelectorList const& selectors, sf::Color color, double transition);
     void add_static_tile_color(Config::SelectorList const& selectors, sf::Color color);
+    // Changes every time the result of resolve_color() may change.
+    size_t tile_colors_version() const { return m_tile_colors_version; }
+    void invalidate_tile_colors() { m_tile_colors_version++; }
     TileWorld& tile_world() { return m_tile_world; }
 
     bool load_config_file(std::string const& path);
@@ -147,11 +164,15 @@ public:
     auto& pedals() const { return m_pedals; }
 
 private:
+    void update_tile_color_table() const;
+
     void generate_dust_texture();
     void generate_minimap_texture();
     size_t calculate_current_tick() const;
 
+    sf::RenderTexture* frame_buffer(sf::Vector2u size);
     void render_notes(sf::RenderTarget& target) const;
+    void render_notes_incrementally(sf::RenderTarget& target);
     void render_particles(sf::RenderTarget& target) const;
     void render_overlay(sf::RenderTarget& target) const;
     void render_background(sf::RenderTarget& target) const;
@@ -159,8 +180,11 @@ private:
     void render_progress_bar(sf::RenderTarget& target) const;
     void render_pedals(sf::RenderTarget& target) const;
 
+    void execute_event(Event const&);
+
     bool reload_config_file();
     void reset_midi();
+    void restore_playback_state(PlaybackState const&);
     void seek(size_t tick);
 
     sf::FloatRect progress_bar_rect(sf::Vector2f window_size) const
@@ -174,11 +198,15 @@ private:
 
     Util::Vector2f get_turbulence_at(Util::Point2f) const;
 
-    uint32_t m_microseconds_per_quarter_note { 500000 }; // 120 BPM
     unsigned m_fps { 60 };
     bool m_seeked_in_previous_frame = false;
+    // Nothing if it's not known, in which case all notes are released
+    std::optional<PlaybackState> m_state_after_seek;
     size_t m_current_tick { 0 };
+    EventTimeline::Cursor m_playhead;
     size_t m_current_frame { 0 };
+    size_t m_visible_ticks_ahead { 0 };
+    size_t m_visible_ticks_behind { 0 };
     std::atomic<bool> m_playing { true };
     bool m_paused = false;
     bool m_initialized { false };
@@ -198,6 +226,24 @@ private:
     std::list<Particle> m_dust_particles;
     std::list<Particle> m_smoke_particles;
     std::vector<std::pair<Config::SelectorList, sf::Color>> m_static_tile_colors;
+    // Changes every time m_static_tile_colors does. Starts at 1 as tiles use 0 for "not cached".
+    uint32_t m_static_tile_colors_version = 1;
+    size_t m_tile_colors_version = 0;
+
+    // Colors of tiles for each channel and key, so that resolve_color() doesn't need to go
+    // through all the rules for every tile.
+    struct TileColorEntry {
+        sf::Color color;
+        // Index into m_static_tile_colors of the first rule that matches all tiles of this unit,
+        // or its size if there is none (then the color comes from transitions).
+        uint16_t rule = 0;
+        // Some rule before `rule` matches only some tiles (e.g by time), so they need to be checked one by one.
+        bool depends_on_tile = false;
+    };
+    mutable std::array<std::array<TileColorEntry, 128>, 16> m_tile_color_table;
+    // Versions of colors and static rules that m_tile_color_table was resolved for.
+    mutable std::optional<size_t> m_tile_color_table_version;
+    mutable uint32_t m_tile_color_table_rules_version = 0;
 
     struct Label {
         LabelType type;
@@ -222,16 +268,53 @@ private:
         sf::Texture minimap_texture;
         sf::Texture pedals_texture;
         sf::Texture smoke_texture;
+        // See transition_color_texture().
+        NoteTransitions::Colors transition_colors;
+        sf::Texture transition_color_texture;
+        std::optional<size_t> transition_color_texture_version;
         std::map<std::string, sf::Texture> background_textures;
+
+        // Frames are drawn here before post-processing. Kept between frames, as creating
+        // a render texture is expensive; there is one per size of target that is drawn to.
+        struct FrameBuffer {
+            sf::RenderTexture texture;
+            size_t last_used_frame = 0;
+        };
+        std::map<std::pair<unsigned, unsigned>, FrameBuffer> frame_buffers;
+
+        // Tiles drawn in previous frames, see render_notes_incrementally().
+        struct TileLayer {
+            // Everything except scrolling and transitions that the drawn tiles depend on.
+            struct Key {
+                sf::Vector2u size;
+                double scale {};
+                uint32_t static_colors_version {};
+                float merge_threshold {};
+
+                bool operator==(Key const&) const = default;
+            };
+            // Drawn alternately, as a texture can't be drawn into itself.
+            sf::RenderTexture textures[2];
+            size_t front = 0;
+            std::optional<Key> key;
+            // Position of the tiles on the layer, in pixels.
+            long long scroll = 0;
+            // Transition colors that the tiles were drawn with, to find keys that need to be redrawn.
+            NoteTransitions::Colors transition_colors;
+            size_t redrawn_rows = 0;
+            size_t redrawn_columns = 0;
+        } tile_layer;
     };
 
     std::unique_ptr<RenderResources> m_render_resources;
+    // Frames are rendered to it instead of the window when rendering a video.
+    std::unique_ptr<VideoOutput> m_video_output;
 
     MIDIPlayerConfig m_config { *this };
     std::string m_config_file_path;
     FileWatcher m_config_file_watcher;
 
-    std::unordered_map<NoteEvent::TransitionUnit, Config::AnimatableProperty<sf::Color>> m_note_transitions;
+    NoteTransitions m_note_transitions;
 
     std::chrono::time_point<std::chrono::system_clock> m_start_time;
     std::unique_ptr<MIDIInput> m_midi_input;
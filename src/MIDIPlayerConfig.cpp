@@ -37,6 +37,7 @@ MIDIPlayerConfig::MIDIPlayerConfig(MIDIPlayer& player)
         { { Config::PropertyType::ColorRGBA, "color" } },
         [&](Config::ArgumentList const& arglist, double) -> bool {
             m_properties.default_color = arglist[0].as_color();
+            m_reader.player().invalidate_tile_colors();
             return true;
         });
     m_info.register_property("background_color",
@@ -136,6 +137,20 @@ MIDIPlayerConfig::MIDIPlayerConfig(MIDIPlayer& player)
             m_properties.scale.set_value_with_factor(arglist[0].as_float(), factor);
             return true;
         });
+    m_info.register_property("tile_merge_threshold",
+        "Tiles of the same key and color that are shorter than this and closer than this to each other are drawn as one (in pixels, 0 disables)",
+        { { Config::PropertyType::Float, "pixels" } },
+        [&](Config::ArgumentList const& arglist, double) -> bool {
+            m_properties.tile_merge_threshold = arglist[0].as_float();
+            return true;
+        });
+    m_info.register_property("incremental_tiles",
+        "Scroll tiles drawn in the previous frame and draw only the newly visible ones (0 or 1). Not used in realtime mode.",
+        { { Config::PropertyType::Int, "enabled", std::make_shared<Range>(0, 1) } },
+        [&](Config::ArgumentList const& arglist, double) -> bool {
+            m_properties.incremental_tiles = arglist[0].as_int();
+            return true;
+        });
     m_info.register_property("background_image",
         "Path to background image",
         { { Config::PropertyType::String, "path" } },
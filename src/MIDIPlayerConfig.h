@@ -48,6 +48,8 @@ public:
     auto smoke_physics() const { return m_properties.smoke_physics; }
     size_t max_events_per_track() const { return m_properties.max_events_per_track; }
     double scale() const { return m_properties.scale; }
+    float tile_merge_threshold() const { return m_properties.tile_merge_threshold; }
+    bool incremental_tiles() const { return m_properties.incremental_tiles; }
     int label_font_size() const { return m_properties.label_font_size; }
     int label_fade_time() const { return m_properties.label_fade_time; }
     BlendedBackground background_image() const { return m_properties.background_image; }
@@ -86,6 +88,8 @@ private:
         };
         size_t max_events_per_track = 4096;
         Config::AnimatableProperty<double> scale { 0.02 };
+        float tile_merge_threshold = 2;
+        bool incremental_tiles = false;
         int label_font_size = 50;
         int label_fade_time = 30;
         Config::AnimatableProperty<AnimatableBackground> background_image;
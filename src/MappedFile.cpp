@@ -0,0 +1,63 @@
+#include "MappedFile.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+Util::OsErrorOr<MappedFile> MappedFile::map(std::string const& path)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return Util::OsError { errno, "open" };
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        auto error = errno;
+        close(fd);
+        return Util::OsError { error, "fstat" };
+    }
+
+    MappedFile file;
+    file.m_size = st.st_size;
+    if (file.m_size == 0) {
+        close(fd);
+        return file;
+    }
+
+    void* data = mmap(nullptr, file.m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    auto error = errno;
+    // The mapping keeps its own reference to the file.
+    close(fd);
+    if (data == MAP_FAILED)
+        return Util::OsError { error, "mmap" };
+
+    // The SMF parser reads the file front to back.
+    madvise(data, file.m_size, MADV_SEQUENTIAL);
+    file.m_data = static_cast<uint8_t const*>(data);
+    return file;
+}
+
+MappedFile::MappedFile(MappedFile&& other)
+{
+    *this = std::move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other)
+{
+    if (this == &other)
+        return *this;
+
+    if (m_data)
+        munmap(const_cast<uint8_t*>(m_data), m_size);
+    m_data = std::exchange(other.m_data, nullptr);
+    m_size = std::exchange(other.m_size, 0);
+    return *this;
+}
+
+MappedFile::~MappedFile()
+{
+    if (m_data)
+        munmap(const_cast<uint8_t*>(m_data), m_size);
+}
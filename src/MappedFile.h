@@ -0,0 +1,27 @@
+#pragma once
+
+#include "Error.h"
+
+#include <cstdint>
+#include <span>
+#include <string>
+
+// Read-only memory mapping of a whole file.
+class MappedFile {
+public:
+    static Util::OsErrorOr<MappedFile> map(std::string const& path);
+
+    MappedFile() = default;
+    MappedFile(MappedFile const&) = delete;
+    MappedFile& operator=(MappedFile const&) = delete;
+    MappedFile(MappedFile&&);
+    MappedFile& operator=(MappedFile&&);
+    ~MappedFile();
+
+    std::span<uint8_t const> data() const { return { m_data, m_size }; }
+    size_t size() const { return m_size; }
+
+private:
+    uint8_t const* m_data {};
+    size_t m_size {};
+};
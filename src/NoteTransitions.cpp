@@ -0,0 +1,40 @@
+#include "NoteTransitions.h"
+
+#include <algorithm>
+
+void NoteTransitions::set_color(UnitMask const& units, sf::Color color, float factor)
+{
+    uint8_t const components[4] { color.r, color.g, color.b, color.a };
+    for (size_t unit = 0; unit < TransitionUnit::Count; unit++) {
+        if (!units[unit])
+            continue;
+        // NOTE: A factor of 1 means that the transition has finished.
+        bool reset = !m_is_set[unit] || factor == 1;
+        for (size_t c = 0; c < 4; c++) {
+            m_next[c][unit] = components[c];
+            if (reset)
+                m_current[c][unit] = components[c];
+        }
+        m_factors[unit] = factor;
+        m_is_set[unit] = true;
+    }
+}
+
+void NoteTransitions::blend(sf::Color default_color, Colors& colors) const
+{
+    // Like AnimatableProperty<sf::Color>, components saturate and alpha is not scaled.
+    Components blended;
+    for (size_t c = 0; c < 3; c++) {
+        auto const& current = m_current[c];
+        auto const& next = m_next[c];
+        for (size_t unit = 0; unit < TransitionUnit::Count; unit++) {
+            int value = static_cast<int>(current[unit] * (1 - m_factors[unit])) + static_cast<int>(next[unit] * m_factors[unit]);
+            blended[c][unit] = std::min(value, 255);
+        }
+    }
+    for (size_t unit = 0; unit < TransitionUnit::Count; unit++)
+        blended[3][unit] = std::min(m_current[3][unit] + m_next[3][unit], 255);
+
+    for (size_t unit = 0; unit < TransitionUnit::Count; unit++)
+        colors[unit] = m_is_set[unit] ? sf::Color { blended[0][unit], blended[1][unit], blended[2][unit], blended[3][unit] } : default_color;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "Event.h"
+
+#include <SFML/Graphics/Color.hpp>
+#include <array>
+#include <bitset>
+#include <cstdint>
+
+// Tile colors set by animate_color, for every transition unit. Color components are
+// stored in separate arrays, so that blending all units is a loop the compiler vectorizes.
+class NoteTransitions {
+public:
+    using UnitMask = std::bitset<TransitionUnit::Count>;
+
+    // Move colors of `units` towards `color`, `factor` of the way from where the
+    // transition started. Units that had no color yet get `color` right away.
+    void set_color(UnitMask const& units, sf::Color color, float factor);
+
+    using Colors = std::array<sf::Color, TransitionUnit::Count>;
+    // Current color of every unit, or `default_color` for units that were never set.
+    void blend(sf::Color default_color, Colors& colors) const;
+
+private:
+    using Components = std::array<std::array<uint8_t, TransitionUnit::Count>, 4>;
+
+    std::array<bool, TransitionUnit::Count> m_is_set {};
+    Components m_current {};
+    Components m_next {};
+    std::array<float, TransitionUnit::Count> m_factors {};
+};
@@ -0,0 +1,111 @@
+#include "PlaybackState.h"
+
+#include <algorithm>
+
+PlaybackState::PlaybackState()
+{
+    for (auto& controllers : m_controllers)
+        controllers.fill(Unset);
+    m_programs.fill(Unset);
+}
+
+void PlaybackState::apply(Event const& event)
+{
+    auto channel = event.channel();
+    switch (event.type()) {
+        case Event::Type::NoteOn:
+            m_note_velocities[channel][event.key().code()] = event.velocity();
+            break;
+        case Event::Type::NoteOff:
+            m_note_velocities[channel][event.key().code()] = 0;
+            break;
+        case Event::Type::ControlChange:
+            switch (event.control_number()) {
+                // 4 - Channel Mode Messages
+                case ControlChangeNumber::AllSoundOff:
+                case ControlChangeNumber::AllNotesOff:
+                case ControlChangeNumber::OmniModeOff:
+                case ControlChangeNumber::OmniModeOn:
+                case ControlChangeNumber::PolyModeOn:
+                case ControlChangeNumber::PolyModeOnInclMono:
+                    m_note_velocities[channel].fill(0);
+                    break;
+                case ControlChangeNumber::ResetAllControllers:
+                    m_controllers[channel].fill(Unset);
+                    break;
+                case ControlChangeNumber::LocalControlOnOff:
+                    break;
+                default:
+                    m_controllers[channel][static_cast<size_t>(event.control_number())] = event.control_value();
+                    // Same as MIDIPlayer::execute_event
+                    if (event.control_number() == ControlChangeNumber::DamperPedal)
+                        m_pedals.set_sustain(event.control_value() > 0);
+                    else if (event.control_number() == ControlChangeNumber::Sostenuto)
+                        m_pedals.set_sostenuto(event.control_value() > 0);
+                    else if (event.control_number() == ControlChangeNumber::SoftPedal)
+                        m_pedals.set_soft(event.control_value() > 0);
+                    break;
+            }
+            break;
+        case Event::Type::ProgramChange:
+            m_programs[channel] = event.program();
+            break;
+        case Event::Type::Invalid:
+        case Event::Type::EndOfTrack:
+        case Event::Type::Text:
+        // Tempo is taken care of by the TempoMap
+        case Event::Type::SetTempo:
+        case Event::Type::TimeSignature:
+            break;
+    }
+}
+
+std::vector<Event> PlaybackState::restoring_events() const
+{
+    std::vector<Event> events;
+    for (MIDIChannel channel = 0; channel < ChannelCount; channel++) {
+        if (m_programs[channel] != Unset)
+            events.push_back(Event::program_change(channel, m_programs[channel]));
+        for (size_t number = 0; number < m_controllers[channel].size(); number++) {
+            if (m_controllers[channel][number] != Unset)
+                events.push_back(Event::control_change(channel, static_cast<ControlChangeNumber>(number), m_controllers[channel][number]));
+        }
+        for (size_t key = 0; key < KeyCount; key++) {
+            if (m_note_velocities[channel][key] > 0)
+                events.push_back(Event::note(true, channel, key, m_note_velocities[channel][key]));
+        }
+    }
+    return events;
+}
+
+void PlaybackKeyframes::build(EventTimeline const& timeline)
+{
+    m_keyframes.clear();
+    PlaybackState state;
+    auto events = timeline.events();
+    size_t next_keyframe_index = 0;
+    for (size_t s = 0; s < events.size(); s++) {
+        // Keyframes are at tick boundaries, so that they are equivalent to a seek to that tick.
+        if (s >= next_keyframe_index && (s == 0 || events[s - 1].tick() < events[s].tick())) {
+            m_keyframes.push_back({ events[s].tick(), state });
+            next_keyframe_index = s + Interval;
+        }
+        state.apply(events[s]);
+    }
+}
+
+PlaybackState PlaybackKeyframes::state_at(EventTimeline const& timeline, size_t tick) const
+{
+    // Last keyframe not after `tick`
+    auto keyframe = std::ranges::upper_bound(m_keyframes, tick, {}, &Keyframe::tick);
+    PlaybackState state;
+    size_t start_tick = 0;
+    if (keyframe != m_keyframes.begin()) {
+        --keyframe;
+        state = keyframe->state;
+        start_tick = keyframe->tick;
+    }
+    for (auto const& event : timeline.events_in_range(start_tick, tick))
+        state.apply(event);
+    return state;
+}
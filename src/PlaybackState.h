@@ -0,0 +1,61 @@
+#pragma once
+
+#include "Event.h"
+#include "EventTimeline.h"
+#include "Pedals.hpp"
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+// State of MIDI playback at some point of a timeline: everything that is needed
+// to continue playing from there as if all events before were played.
+class PlaybackState {
+public:
+    static constexpr size_t ChannelCount = 16;
+    static constexpr size_t KeyCount = 128;
+
+    PlaybackState();
+
+    void apply(Event const&);
+
+    // 0 if the note isn't held
+    uint8_t note_velocity(MIDIChannel channel, MIDIKey key) const { return m_note_velocities[channel][key.code()]; }
+    Pedals const& pedals() const { return m_pedals; }
+
+    // Events that bring a device that was reset (All Sound Off, Reset All Controllers)
+    // to this state: programs, controllers and Note Ons of held notes.
+    std::vector<Event> restoring_events() const;
+
+private:
+    // Controller values and programs are 7-bit, so this can't be a real value.
+    static constexpr uint8_t Unset = 0xff;
+
+    std::array<std::array<uint8_t, KeyCount>, ChannelCount> m_note_velocities {};
+    std::array<std::array<uint8_t, static_cast<size_t>(ControlChangeNumber::Count)>, ChannelCount> m_controllers;
+    std::array<uint8_t, ChannelCount> m_programs;
+    // Pedals as shown by MIDIPlayer, that is, from the last pedal event on any channel
+    Pedals m_pedals;
+};
+
+// Playback states saved at regular intervals of a timeline, so that seeking
+// only needs to replay events since the nearest keyframe.
+class PlaybackKeyframes {
+public:
+    // A keyframe is saved every that many events. Replaying them takes well below a millisecond.
+    static constexpr size_t Interval = 1 << 15;
+
+    void build(EventTimeline const&);
+
+    // State after all events before `tick`
+    PlaybackState state_at(EventTimeline const&, size_t tick) const;
+
+private:
+    struct Keyframe {
+        // State after all events before this tick
+        size_t tick;
+        PlaybackState state;
+    };
+
+    std::vector<Keyframe> m_keyframes;
+};
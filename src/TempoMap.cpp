@@ -0,0 +1,55 @@
+#include "TempoMap.h"
+
+#include <algorithm>
+
+TempoMap::TempoMap(uint16_t ticks_per_quarter_note, std::vector<TempoChange> tempo_changes)
+    : m_tempo_changes(std::move(tempo_changes))
+{
+    std::ranges::stable_sort(m_tempo_changes, {}, &TempoChange::tick);
+
+    // Avoid division by zero for broken files
+    double ticks = std::max<uint16_t>(ticks_per_quarter_note, 1);
+    // Same for a zero tempo, which would stop time at the tempo change.
+    auto microseconds_per_tick = [&](uint32_t microseconds_per_quarter_note) {
+        return std::max<uint32_t>(microseconds_per_quarter_note, 1) / ticks;
+    };
+
+    m_segments.push_back({ 0, 0, microseconds_per_tick(DefaultMicrosecondsPerQuarterNote) });
+    for (auto const& change : m_tempo_changes) {
+        auto& last = m_segments.back();
+        if (change.tick == last.start_tick) {
+            last.microseconds_per_tick = microseconds_per_tick(change.microseconds_per_quarter_note);
+            continue;
+        }
+        double start_microseconds = last.start_microseconds + (change.tick - last.start_tick) * last.microseconds_per_tick;
+        m_segments.push_back({ static_cast<double>(change.tick), start_microseconds, microseconds_per_tick(change.microseconds_per_quarter_note) });
+    }
+}
+
+TempoMap TempoMap::with_constant_rate(double ticks_per_second)
+{
+    TempoMap map;
+    auto& segment = map.m_segments.front();
+    segment.microseconds_per_tick = 1000000 / std::max(ticks_per_second, 1.0);
+    return map;
+}
+
+TempoMap::Segment const& TempoMap::segment_at_tick(double tick) const
+{
+    // Last segment that starts not after `tick`
+    auto it = std::ranges::upper_bound(m_segments, tick, {}, &Segment::start_tick);
+    return it == m_segments.begin() ? *it : *std::prev(it);
+}
+
+double TempoMap::tick_to_microseconds(double tick) const
+{
+    auto const& segment = segment_at_tick(tick);
+    return segment.start_microseconds + (tick - segment.start_tick) * segment.microseconds_per_tick;
+}
+
+double TempoMap::microseconds_to_tick(double microseconds) const
+{
+    auto it = std::ranges::upper_bound(m_segments, microseconds, {}, &Segment::start_microseconds);
+    auto const& segment = it == m_segments.begin() ? *it : *std::prev(it);
+    return segment.start_tick + (microseconds - segment.start_microseconds) / segment.microseconds_per_tick;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Converts between ticks and wall-clock time, taking every tempo change into account.
+// Both directions are a binary search over segments of constant tempo.
+class TempoMap {
+public:
+    static constexpr uint32_t DefaultMicrosecondsPerQuarterNote = 500000; // 120 BPM
+
+    struct TempoChange {
+        size_t tick;
+        uint32_t microseconds_per_quarter_note;
+    };
+
+    // Metrical time division. Tempo changes don't need to be sorted; the last one wins
+    // if there are multiple changes at the same tick.
+    explicit TempoMap(uint16_t ticks_per_quarter_note = 192, std::vector<TempoChange> tempo_changes = {});
+
+    // SMPTE (timecode-based) time division: constant number of ticks per second, tempo changes don't apply.
+    static TempoMap with_constant_rate(double ticks_per_second);
+
+    double tick_to_microseconds(double tick) const;
+    double microseconds_to_tick(double microseconds) const;
+    double tick_to_seconds(double tick) const { return tick_to_microseconds(tick) / 1000000; }
+    double seconds_to_tick(double seconds) const { return microseconds_to_tick(seconds * 1000000); }
+
+    std::vector<TempoChange> const& tempo_changes() const { return m_tempo_changes; }
+
+private:
+    struct Segment {
+        double start_tick;
+        double start_microseconds;
+        double microseconds_per_tick;
+    };
+
+    Segment const& segment_at_tick(double tick) const;
+
+    // Sorted by both start_tick and start_microseconds, the first one starts at 0.
+    std::vector<Segment> m_segments;
+    std::vector<TempoChange> m_tempo_changes;
+};
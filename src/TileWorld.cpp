@@ -2,38 +2,320 @@
 
 #include "MIDIPlayer.h"
 #include <SFML/Graphics/RenderStates.hpp>
+#include <SFML/Graphics/VertexBuffer.hpp>
+#include <bit>
+#include <ranges>
 
 void Tile::dump() const
 {
+    auto end = end_tick();
     fmt::print("{}..{}: {} @C{}\n",
         start_tick,
-        end_tick ? std::to_string(*end_tick) : "now",
+        end ? std::to_string(*end) : "now",
         transition_unit.key.code(),
         transition_unit.channel);
 }
 
-void TileWorld::push_note_event(NoteEvent const& event)
+void TilePool::push_back(Tile const& tile)
+{
+    if (m_size == m_chunks.size() * ChunkSize) {
+        m_chunks.emplace_back().reserve(ChunkSize);
+    }
+    m_chunks.back().push_back(tile);
+    m_size++;
+}
+
+void TilePool::truncate(size_t size)
+{
+    if (size >= m_size)
+        return;
+    m_chunks.resize((size + ChunkSize - 1) / ChunkSize);
+    if (!m_chunks.empty()) {
+        auto& last_chunk = m_chunks.back();
+        last_chunk.erase(last_chunk.begin() + (size - (m_chunks.size() - 1) * ChunkSize), last_chunk.end());
+    }
+    m_size = size;
+}
+
+void TilePool::clear()
+{
+    m_chunks.clear();
+    m_size = 0;
+}
+
+size_t TilePool::upper_bound(size_t tick) const
+{
+    return *std::ranges::partition_point(std::views::iota(size_t { 0 }, m_size), [&](size_t index) {
+        return (*this)[index].start_tick <= tick;
+    });
+}
+
+size_t TilePool::lower_bound(size_t tick) const
+{
+    return *std::ranges::partition_point(std::views::iota(size_t { 0 }, m_size), [&](size_t index) {
+        return (*this)[index].start_tick < tick;
+    });
+}
+
+namespace {
+
+// Tiles are drawn larger by this to make room for bloom.
+constexpr float TileExtent = 1;
+
+// Transition colors change often (e.g every frame when animating), so tiles that take their color
+// from their transition unit store the unit instead, and note.frag looks its color up: red is the key,
+// green the channel, blue 255 and alpha 0. Transparent static colors are stored as transparent black,
+// so that they aren't mistaken for that.
+sf::Color tile_vertex_color(Tile const& tile, MIDIPlayer const& player)
+{
+    auto color = player.static_color(tile);
+    if (!color)
+        return { tile.transition_unit.key.code(), tile.transition_unit.channel, 255, 0 };
+    if (color->a == 0)
+        return sf::Color::Transparent;
+    return *color;
+}
+
+}
+
+void TileWorld::push_note_event(Event const& event)
 {
     auto transition_unit = event.transition_unit();
     switch (event.type()) {
-        case NoteEvent::Type::On: {
-            auto& tile = m_tiles.emplace_back(Tile { event.tick(), {}, transition_unit });
-            m_pending_tiles[transition_unit].push_back(&tile);
+        case Event::Type::NoteOn: {
+            if (!m_tiles.empty() && event.tick() < m_tiles.back().start_tick) {
+                // Keep tiles sorted. Events come in order except in rare cases, so just rebuild everything.
+                auto position = m_tiles.upper_bound(event.tick());
+                m_tiles.push_back(Tile { event.tick(), {}, transition_unit });
+                for (size_t s = m_tiles.size() - 1; s > position; s--)
+                    std::swap(m_tiles[s], m_tiles[s - 1]);
+                for (auto& channel_tiles : m_pending_tiles) {
+                    for (auto& tiles : channel_tiles) {
+                        for (auto& index : tiles) {
+                            if (index >= position)
+                                index++;
+                        }
+                    }
+                }
+                pending_tiles(transition_unit).push_back(position);
+                rebuild_index();
+                break;
+            }
+            m_tiles.push_back(Tile { event.tick(), {}, transition_unit });
+            pending_tiles(transition_unit).push_back(m_tiles.size() - 1);
+            invalidate_chunk_of(m_tiles.size() - 1);
+            auto block = (m_tiles.size() - 1) / BlockSize;
+            if (block == m_blocks.size())
+                m_blocks.emplace_back();
+            m_blocks[block].pending_count++;
+            update_block(block);
         } break;
-        case NoteEvent::Type::Off: {
-            auto& tiles = m_pending_tiles[transition_unit];
+        case Event::Type::NoteOff: {
+            auto& tiles = pending_tiles(transition_unit);
             if (tiles.empty()) {
                 fmt::print("NoteOff without NoteOn!\n");
                 // This may happen when launching MIDIPlayer with a midi key pressed,
                 // then depressing that key
                 return;
             }
-            tiles.back()->end_tick = event.tick();
+            auto index = tiles.back();
             tiles.pop_back();
+            m_tiles[index].set_end_tick(event.tick());
+            invalidate_chunk_of(index);
+            auto& block = m_blocks[index / BlockSize];
+            block.pending_count--;
+            block.max_end_tick = std::max(block.max_end_tick, event.tick());
+            update_block(index / BlockSize);
         } break;
+        default:
+            break;
+    }
+}
+
+void TileWorld::set_tiles(std::vector<Tile> tiles)
+{
+    clear_pending_tiles();
+    std::ranges::stable_sort(tiles, {}, &Tile::start_tick);
+    m_tiles.clear();
+    for (auto const& tile : tiles)
+        m_tiles.push_back(tile);
+    rebuild_index();
+}
+
+void TileWorld::clear()
+{
+    clear_pending_tiles();
+    m_tiles.clear();
+    rebuild_index();
+}
+
+void TileWorld::clear_pending_tiles()
+{
+    // NOTE: This keeps the stacks allocated, they are reused in the next file anyway.
+    for (auto& channel_tiles : m_pending_tiles) {
+        for (auto& tiles : channel_tiles)
+            tiles.clear();
+    }
+}
+
+std::bitset<128> TileWorld::keys_with_pending_tiles() const
+{
+    std::bitset<128> keys;
+    for (auto const& channel_tiles : m_pending_tiles) {
+        for (size_t key = 0; key < 128; key++) {
+            if (!channel_tiles[key].empty())
+                keys.set(key);
+        }
+    }
+    return keys;
+}
+
+std::pair<float, float> TileWorld::key_x_range(MIDIKey key)
+{
+    // See append_tile in render()
+    bool black = key.is_black();
+    float start = key.to_piano_position() - (black ? 0.15f : 0);
+    float width = black ? 0.7f : 1;
+    return { start - TileExtent / 2, start + width + TileExtent / 2 };
+}
+
+size_t TileWorld::pending_tile_count() const
+{
+    size_t count = 0;
+    for (auto const& channel_tiles : m_pending_tiles) {
+        for (auto const& tiles : channel_tiles)
+            count += tiles.size();
+    }
+    return count;
+}
+
+void TileWorld::remove_tiles_before(size_t tick)
+{
+    // Tiles are sorted by start tick, so only tiles that started before `tick` can have ended before it.
+    // NOTE: Pending tiles have no end tick yet, so they are never removed here.
+    auto can_be_removed = [tick](Tile const& tile) {
+        auto end_tick = tile.end_tick();
+        return end_tick && *end_tick < tick;
+    };
+    auto candidate_count = m_tiles.lower_bound(tick);
+
+    // Removing shifts all tiles that are left, so wait until there is enough of them to make it
+    // worth it. The ones that stay for longer are off screen anyway.
+    if (candidate_count < m_tiles.size() / 4)
+        return;
+    size_t removed_count = 0;
+    for (size_t s = 0; s < candidate_count; s++)
+        removed_count += can_be_removed(m_tiles[s]);
+    if (removed_count == 0 || removed_count < m_tiles.size() / 4)
+        return;
+
+    std::vector<size_t> removed_indices;
+    removed_indices.reserve(removed_count);
+    size_t kept_count = 0;
+    for (size_t s = 0; s < m_tiles.size(); s++) {
+        if (s < candidate_count && can_be_removed(m_tiles[s])) {
+            removed_indices.push_back(s);
+            continue;
+        }
+        m_tiles[kept_count++] = m_tiles[s];
+    }
+    m_tiles.truncate(kept_count);
+    for (auto& channel_tiles : m_pending_tiles) {
+        for (auto& tiles : channel_tiles) {
+            for (auto& index : tiles)
+                index -= std::ranges::upper_bound(removed_indices, index) - removed_indices.begin();
+        }
+    }
+    rebuild_index();
+}
+
+size_t TileWorld::block_max_end_tick(size_t block) const
+{
+    if (m_blocks[block].pending_count > 0)
+        return std::numeric_limits<size_t>::max();
+    return m_blocks[block].max_end_tick;
+}
+
+void TileWorld::update_block(size_t block)
+{
+    if (block >= m_block_capacity) {
+        rebuild_tree();
+        return;
+    }
+    auto node = m_block_capacity + block;
+    m_max_end_ticks[node] = block_max_end_tick(block);
+    for (node /= 2; node > 0; node /= 2) {
+        auto max_end_tick = std::max(m_max_end_ticks[node * 2], m_max_end_ticks[node * 2 + 1]);
+        if (m_max_end_ticks[node] == max_end_tick)
+            break;
+        m_max_end_ticks[node] = max_end_tick;
+    }
+}
+
+void TileWorld::rebuild_tree()
+{
+    // Grow by powers of two so that appending tiles rebuilds the tree only O(log n) times.
+    m_block_capacity = m_blocks.empty() ? 0 : std::bit_ceil(m_blocks.size());
+    m_max_end_ticks.assign(m_block_capacity * 2, 0);
+    for (size_t s = 0; s < m_blocks.size(); s++)
+        m_max_end_ticks[m_block_capacity + s] = block_max_end_tick(s);
+    for (size_t node = m_block_capacity; node-- > 1;)
+        m_max_end_ticks[node] = std::max(m_max_end_ticks[node * 2], m_max_end_ticks[node * 2 + 1]);
+}
+
+void TileWorld::invalidate_chunk_of(size_t tile_index)
+{
+    if (auto chunk = m_chunks.find(tile_index / ChunkSize); chunk != m_chunks.end())
+        chunk->second.layout_version = 0;
+}
+
+void TileWorld::collect_chunk_tiles(size_t first_tile, size_t end_tile, double merge_ticks, MIDIPlayer const& player) const
+{
+    m_chunk_tiles.clear();
+    // The last tile of each key that others can be merged into, as an index into m_chunk_tiles.
+    struct Run {
+        size_t index;
+        sf::Color color;
+    };
+    std::array<std::optional<Run>, 128> runs;
+    for (size_t s = first_tile; s < end_tile; s++) {
+        auto const& tile = m_tiles[s];
+        // NOTE: Chunks are built only when all their tiles ended.
+        auto end_tick = *tile.end_tick();
+        if (end_tick - tile.start_tick >= merge_ticks) {
+            m_chunk_tiles.push_back({ s, tile });
+            continue;
+        }
+        auto color = tile_vertex_color(tile, player);
+        auto& run = runs[tile.transition_unit.key.code()];
+        if (run && run->color == color) {
+            auto& run_tile = m_chunk_tiles[run->index].second;
+            auto run_end_tick = *run_tile.end_tick();
+            if (tile.start_tick < run_end_tick + merge_ticks) {
+                run_tile.set_end_tick(std::max(run_end_tick, end_tick));
+                continue;
+            }
+        }
+        run = Run { m_chunk_tiles.size(), color };
+        m_chunk_tiles.push_back({ s, tile });
     }
 }
 
+void TileWorld::rebuild_index()
+{
+    // Tiles might have moved between chunks.
+    m_chunks.clear();
+    m_blocks.assign((m_tiles.size() + BlockSize - 1) / BlockSize, {});
+    for (size_t s = 0; s < m_tiles.size(); s++) {
+        auto& block = m_blocks[s / BlockSize];
+        if (auto end_tick = m_tiles[s].end_tick())
+            block.max_end_tick = std::max(block.max_end_tick, *end_tick);
+        else
+            block.pending_count++;
+    }
+    rebuild_tree();
+}
+
 void TileWorld::dump() const
 {
     fmt::print("{} events\n", m_tiles.size());
@@ -54,61 +336,158 @@ void TileWorld::render(sf::RenderTarget& target, MIDIPlayer const& player) const
         std::swap(screen_top_offset, screen_bottom_offset);
     }
 
+    // The rounded key is inset by TileSpacing.
+    sf::Vector2f const extent { TileExtent, TileExtent };
+    constexpr float TileSpacing = 2;
+    auto viewport = target.getViewport(target.getView());
+    auto pixels_per_unit = sf::Vector2f {
+        viewport.size.x / target.getView().getSize().x,
+        viewport.size.y / target.getView().getSize().y,
+    };
+
     auto tile_is_visible = [&](float tile_start, float tile_end) {
         return tile_end > screen_top_offset && tile_start < screen_bottom_offset;
     };
 
-    auto render_tile = [&](Tile const& tile) {
-        float y_start = tile.start_tick;
-        float y_end = tile.end_tick.value_or(offset + 10);
-        if (player.real_time()) {
-            y_start = y_start - offset;
-            y_end = y_end - offset;
-        } else {
-            y_start = -(y_start - offset);
-            y_end = -(y_end - offset);
+    // Vertical extent of a tile, relative to `origin_tick` which is at y = 0.
+    auto tile_y_range = [&](Tile const& tile, double origin_tick) {
+        float y_start = tile.start_tick - origin_tick;
+        float y_end = tile.end_tick().value_or(offset + 10) - origin_tick;
+        if (!player.real_time()) {
+            y_start = -y_start;
+            y_end = -y_end;
         }
         // Avoid negative sizes
         if (y_start > y_end) {
             std::swap(y_start, y_end);
         }
-        y_start *= player.scale();
-        y_end *= player.scale();
-        if (!tile_is_visible(y_start, y_end)) {
-            return;
-        }
+        return std::pair { y_start * static_cast<float>(player.scale()), y_end * static_cast<float>(player.scale()) };
+    };
 
-        auto color = player.resolve_color(tile);
+    auto append_tile = [&](Tile const& tile, float y_start, float y_end) {
+        auto color = tile_vertex_color(tile, player);
         float x_position = tile.transition_unit.key.to_piano_position();
 
-        sf::Vector2f const extent { 1, 1 };
         bool black = tile.transition_unit.key.is_black();
         auto tile_size = sf::Vector2f { black ? 0.7f : 1, y_end - y_start };
-        auto tile_position = sf::Vector2f { x_position - (black ? 0.15f : 0), y_start };
-
-        sf::RectangleShape rect(tile_size + extent);
-        rect.setPosition(tile_position - extent / 2.f);
-        rect.setFillColor(color);
+        auto tile_center = sf::Vector2f { x_position - (black ? 0.15f : 0), y_start } + tile_size / 2.f;
 
-        constexpr float TileSpacing = 2;
+        // Texture coordinates are the offset of the corner from the tile center in pixels, so that
+        // note.frag knows both where the fragment is in the tile and how large the tile is.
+        auto half_size = tile_size / 2.f + extent / 2.f;
+        auto half_size_px = sf::Vector2f { half_size.x * pixels_per_unit.x, half_size.y * pixels_per_unit.y };
+        auto corner = [&](float x, float y) {
+            return sf::Vertex {
+                .position = tile_center + sf::Vector2f { half_size.x * x, half_size.y * y },
+                .color = color,
+                .texCoords = { half_size_px.x * x, half_size_px.y * y },
+            };
+        };
+        m_vertices.push_back(corner(-1, -1));
+        m_vertices.push_back(corner(1, -1));
+        m_vertices.push_back(corner(-1, 1));
+        m_vertices.push_back(corner(-1, 1));
+        m_vertices.push_back(corner(1, -1));
+        m_vertices.push_back(corner(1, 1));
+    };
 
-        auto screen_tile_position = target.mapCoordsToPixel(tile_position);
-        screen_tile_position.x += TileSpacing;
-        screen_tile_position.y += TileSpacing;
-        auto screen_tile_end_position = target.mapCoordsToPixel(tile_position + tile_size);
-        screen_tile_end_position.x -= TileSpacing;
-        screen_tile_end_position.y -= TileSpacing;
+    auto render_tile = [&](Tile const& tile) {
+        auto [y_start, y_end] = tile_y_range(tile, offset);
+        if (tile_is_visible(y_start, y_end)) {
+            append_tile(tile, y_start, y_end);
+        }
+    };
 
-        sf::Vector2f screen_tile_size { screen_tile_end_position - screen_tile_position };
+    // Find ticks that map to the visible part of the screen, see tile_y_range for the other direction.
+    double first_visible_tick = screen_top_offset / player.scale();
+    double last_visible_tick = screen_bottom_offset / player.scale();
+    if (player.real_time()) {
+        first_visible_tick = offset + first_visible_tick;
+        last_visible_tick = offset + last_visible_tick;
+    } else {
+        first_visible_tick = offset - first_visible_tick;
+        last_visible_tick = offset - last_visible_tick;
+    }
+    if (first_visible_tick > last_visible_tick) {
+        std::swap(first_visible_tick, last_visible_tick);
+    }
+    // Pad by a tick to account for float rounding in tile_y_range, render_tile still culls tiles exactly.
+    auto to_tick = [](double tick) -> size_t { return tick > 0 ? static_cast<size_t>(std::min(tick, 0x1p63)) : 0; };
+    size_t start_tick = to_tick(first_visible_tick - 1);
+    size_t end_tick = to_tick(last_visible_tick + 1);
 
-        auto& shader = player.note_shader();
-        shader.setUniform("uKeySize", screen_tile_size);
-        shader.setUniform("uKeyPos", sf::Vector2f { static_cast<float>(screen_tile_position.x), static_cast<float>(target.getSize().y - screen_tile_position.y - screen_tile_size.y) });
-        shader.setUniform("uIsBlack", black);
-        target.draw(rect, sf::RenderStates { &shader });
+    auto& shader = player.note_shader();
+    shader.setUniform("uTransitionColors", player.transition_color_texture());
+    shader.setUniform("uMargin", sf::Vector2f { extent.x / 2 * pixels_per_unit.x, extent.y / 2 * pixels_per_unit.y } + sf::Vector2f { TileSpacing, TileSpacing });
+    auto draw_vertices = [&] {
+        if (!m_vertices.empty()) {
+            target.draw(m_vertices.data(), m_vertices.size(), sf::PrimitiveType::Triangles, sf::RenderStates { &shader });
+        }
+        m_vertices.clear();
     };
+    m_vertices.clear();
 
-    for (auto const& tile : m_tiles) {
-        render_tile(tile);
+    if (!sf::VertexBuffer::isAvailable()) {
+        for_each_tile_in_range(start_tick, end_tick, render_tile);
+        draw_vertices();
+        return;
     }
+
+    ChunkLayout layout { player.scale(), pixels_per_unit, player.real_time(), player.static_tile_colors_version(), player.config().tile_merge_threshold() };
+    if (layout != m_chunk_layout) {
+        m_chunk_layout = layout;
+        m_layout_version++;
+    }
+
+    size_t last_tile = m_tiles.upper_bound(end_tick);
+    m_drawn_chunks.clear();
+    for_each_block_range(start_tick, last_tile, ChunkSize / BlockSize, [&](size_t first_block, size_t block_count, size_t max_end_tick) {
+        auto first_tile = first_block * BlockSize;
+        auto end_tile = std::min(first_tile + block_count * BlockSize, m_tiles.size());
+
+        // Pending tiles grow every frame, so chunks with them are drawn like in realtime mode.
+        if (max_end_tick == std::numeric_limits<size_t>::max()) {
+            for (size_t s = first_tile; s < std::min(end_tile, last_tile); s++) {
+                if (indexed_end_tick(m_tiles[s]) >= start_tick)
+                    render_tile(m_tiles[s]);
+            }
+            return;
+        }
+
+        // Keep draw order the same as without chunks.
+        draw_vertices();
+        auto& chunk = m_chunks[first_tile / ChunkSize];
+        if (chunk.layout_version != m_layout_version) {
+            chunk.origin_tick = m_tiles[first_tile].start_tick;
+            // In dense passages many tiles of a key fall into the same pixels, so they are drawn as one.
+            collect_chunk_tiles(first_tile, end_tile, layout.merge_threshold / (layout.scale * pixels_per_unit.y), player);
+            chunk.first_tiles.clear();
+            for (auto const& [index, tile] : m_chunk_tiles) {
+                auto [y_start, y_end] = tile_y_range(tile, chunk.origin_tick);
+                append_tile(tile, y_start, y_end);
+                chunk.first_tiles.push_back(index - first_tile);
+            }
+            if (!chunk.vertices.create(m_vertices.size()) || !chunk.vertices.update(m_vertices.data())) {
+                // Draw it directly this time, and retry uploading in the next frame.
+                draw_vertices();
+                return;
+            }
+            m_vertices.clear();
+            chunk.layout_version = m_layout_version;
+        }
+        m_drawn_chunks.push_back(first_tile / ChunkSize);
+
+        double y_offset = (static_cast<double>(chunk.origin_tick) - player.current_tick()) * player.scale();
+        sf::RenderStates states { &shader };
+        states.transform.translate({ 0, static_cast<float>(player.real_time() ? y_offset : -y_offset) });
+        // Tiles after `last_tile` start below the screen.
+        auto quad_count = std::ranges::lower_bound(chunk.first_tiles, last_tile - first_tile) - chunk.first_tiles.begin();
+        target.draw(chunk.vertices, 0, quad_count * 6, states);
+    });
+    draw_vertices();
+
+    // Play mode only scrolls forward, so chunks that went off screen are not needed anymore.
+    std::erase_if(m_chunks, [&](auto const& chunk) {
+        return !std::ranges::binary_search(m_drawn_chunks, chunk.first);
+    });
 }
@@ -2,28 +2,238 @@
 
 #include "Event.h"
 
+#include <SFML/Graphics/RenderTarget.hpp>
+#include <SFML/Graphics/Vertex.hpp>
+#include <SFML/Graphics/VertexBuffer.hpp>
+#include <algorithm>
+#include <array>
+#include <bitset>
 #include <cstddef>
-#include <list>
+#include <cstdint>
+#include <limits>
 #include <optional>
 #include <unordered_map>
+#include <utility>
+#include <vector>
+
+class MIDIPlayer;
 
 struct Tile {
+    Tile(size_t start_tick, std::optional<size_t> end_tick, TransitionUnit transition_unit)
+        : start_tick(start_tick)
+        , transition_unit(transition_unit)
+        , m_end_tick(end_tick.value_or(NoEndTick))
+    {
+    }
+
     size_t start_tick;
-    std::optional<size_t> end_tick;
-    NoteEvent::TransitionUnit transition_unit;
+    TransitionUnit transition_unit;
+    // Static color rule this tile matches, cached by MIDIPlayer::resolve_color() for rules
+    // that depend on more than the transition unit. Fits into padding of the struct.
+    mutable uint16_t color_rule = 0;
+    mutable uint32_t color_rule_version = 0;
+
+    std::optional<size_t> end_tick() const
+    {
+        if (m_end_tick == NoEndTick)
+            return {};
+        return m_end_tick;
+    }
+    void set_end_tick(size_t tick) { m_end_tick = tick; }
 
     void dump() const;
+
+private:
+    // Not std::optional, which would make tiles a third larger.
+    static constexpr size_t NoEndTick = std::numeric_limits<size_t>::max();
+    size_t m_end_tick;
+};
+
+static_assert(sizeof(Tile) == 24);
+
+// Tiles stored in fixed size chunks, so that adding tiles never moves the ones that are
+// already there, and memory doesn't need to double when building a large file.
+class TilePool {
+public:
+    static constexpr size_t ChunkSize = 4096;
+
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    Tile& operator[](size_t index) { return m_chunks[index / ChunkSize][index % ChunkSize]; }
+    Tile const& operator[](size_t index) const { return m_chunks[index / ChunkSize][index % ChunkSize]; }
+    Tile const& back() const { return (*this)[m_size - 1]; }
+
+    void push_back(Tile const&);
+    // Remove all tiles from `size` on.
+    void truncate(size_t size);
+    void clear();
+
+    // Index of the first tile that starts after `tick`. Tiles must be sorted by start tick.
+    size_t upper_bound(size_t tick) const;
+    // Index of the first tile that starts at or after `tick`. Tiles must be sorted by start tick.
+    size_t lower_bound(size_t tick) const;
+
+    class Iterator {
+    public:
+        Iterator(TilePool const& pool, size_t index)
+            : m_pool(&pool)
+            , m_index(index)
+        {
+        }
+
+        Tile const& operator*() const { return (*m_pool)[m_index]; }
+        Iterator& operator++()
+        {
+            m_index++;
+            return *this;
+        }
+        bool operator==(Iterator const&) const = default;
+
+    private:
+        TilePool const* m_pool;
+        size_t m_index;
+    };
+    Iterator begin() const { return { *this, 0 }; }
+    Iterator end() const { return { *this, m_size }; }
+
+private:
+    // Each chunk has capacity for ChunkSize tiles.
+    std::vector<std::vector<Tile>> m_chunks;
+    size_t m_size = 0;
 };
 
 class TileWorld {
 public:
     // For Realtime mode
-    void push_note_event(NoteEvent const& event);
+    void push_note_event(Event const& event);
     void dump() const;
+
+    // Sorted by start tick.
+    TilePool const& tiles() const { return m_tiles; }
+    // Replace all tiles with a layout built before (e.g loaded from cache).
+    void set_tiles(std::vector<Tile> tiles);
+    void clear();
+    // Remove tiles that ended before `tick`. Used for streaming and realtime where tiles scroll off screen for good.
+    void remove_tiles_before(size_t tick);
+    // Tiles that have no end tick yet.
+    size_t pending_tile_count() const;
+    std::bitset<128> keys_with_pending_tiles() const;
+    // Horizontal range that tiles of `key` are drawn in, including room for bloom.
+    static std::pair<float, float> key_x_range(MIDIKey);
+    // Chunks of tiles that currently have their vertices uploaded to the GPU.
+    size_t resident_chunk_count() const { return m_chunks.size(); }
     void render(sf::RenderTarget&, MIDIPlayer const&) const;
 
+    // Call `callback` in start tick order for all tiles that start at or before `end_tick`
+    // and end at or after `start_tick`. Tiles with no end tick yet are always included.
+    template<class Callback>
+    void for_each_tile_in_range(size_t start_tick, size_t end_tick, Callback callback) const
+    {
+        size_t last_tile = m_tiles.upper_bound(end_tick);
+        for_each_block_range(start_tick, last_tile, 1, [&](size_t first_block, size_t, size_t) {
+            auto end_tile = std::min((first_block + 1) * BlockSize, last_tile);
+            for (size_t s = first_block * BlockSize; s < end_tile; s++) {
+                if (indexed_end_tick(m_tiles[s]) >= start_tick)
+                    callback(m_tiles[s]);
+            }
+        });
+    }
+
 private:
-    // List of tiles that haver no end tick set yet.
-    std::unordered_map<NoteEvent::TransitionUnit, std::vector<Tile*>> m_pending_tiles;
-    std::list<Tile> m_tiles;
+    static constexpr size_t BlockSize = 64;
+
+    // Tiles with no end tick yet are indexed as if they never ended.
+    static size_t indexed_end_tick(Tile const& tile) { return tile.end_tick().value_or(std::numeric_limits<size_t>::max()); }
+
+    // Walk down the tree in order, calling `callback` with ranges of at most `max_block_count`
+    // blocks that contain tiles before `last_tile` which end at or after `start_tick`.
+    template<class Callback>
+    void for_each_block_range(size_t start_tick, size_t last_tile, size_t max_block_count, Callback callback) const
+    {
+        size_t last_block = (last_tile + BlockSize - 1) / BlockSize;
+        struct Node {
+            size_t index;
+            size_t first_block;
+            size_t block_count;
+        };
+        Node stack[std::numeric_limits<size_t>::digits + 1];
+        size_t stack_size = 0;
+        if (m_block_capacity > 0)
+            stack[stack_size++] = { 1, 0, m_block_capacity };
+        while (stack_size > 0) {
+            auto node = stack[--stack_size];
+            if (node.first_block >= last_block || m_max_end_ticks[node.index] < start_tick)
+                continue;
+            if (node.block_count > max_block_count) {
+                auto half = node.block_count / 2;
+                stack[stack_size++] = { node.index * 2 + 1, node.first_block + half, half };
+                stack[stack_size++] = { node.index * 2, node.first_block, half };
+                continue;
+            }
+            callback(node.first_block, node.block_count, m_max_end_ticks[node.index]);
+        }
+    }
+
+    size_t block_max_end_tick(size_t block) const;
+    // Propagate a change of tiles in `block` up the tree.
+    void update_block(size_t block);
+    void rebuild_tree();
+    void rebuild_index();
+
+    std::vector<size_t>& pending_tiles(TransitionUnit unit) { return m_pending_tiles[unit.channel][unit.key.code()]; }
+    void clear_pending_tiles();
+
+    // Indices into m_tiles of tiles that have no end tick set yet, per channel and key.
+    std::array<std::array<std::vector<size_t>, 128>, 16> m_pending_tiles;
+    TilePool m_tiles;
+
+    // Max tree over the latest end tick of each block of BlockSize consecutive tiles. Since
+    // tiles are sorted by start tick, this finds tiles overlapping a tick range without going
+    // over every tile that started before it. Leaves start at m_block_capacity.
+    struct Block {
+        size_t max_end_tick = 0;
+        uint32_t pending_count = 0;
+    };
+    std::vector<Block> m_blocks;
+    std::vector<size_t> m_max_end_ticks;
+    size_t m_block_capacity = 0;
+
+    // All visible tiles are drawn at once from here. Kept between frames to not allocate it every time.
+    mutable std::vector<sf::Vertex> m_vertices;
+
+    // Tiles that ended don't change, so their geometry is uploaded to the GPU once per chunk
+    // of ChunkSize consecutive tiles, and then only moved when scrolling. Chunks are uploaded
+    // when they get on screen and released when they leave it.
+    static constexpr size_t ChunkSize = BlockSize * 64;
+    void invalidate_chunk_of(size_t tile_index);
+    // Fill m_chunk_tiles with tiles from `first_tile` to `end_tile`, with runs of tiles of the same key
+    // and color that are shorter and closer to each other than `merge_ticks` merged into one.
+    void collect_chunk_tiles(size_t first_tile, size_t end_tile, double merge_ticks, MIDIPlayer const&) const;
+
+    // Everything except the tiles themselves that chunk geometry depends on.
+    struct ChunkLayout {
+        double scale {};
+        sf::Vector2f pixels_per_unit;
+        bool real_time {};
+        // Colors of transitions are not part of the geometry, see tile_vertex_color().
+        uint32_t static_colors_version {};
+        float merge_threshold {};
+
+        bool operator==(ChunkLayout const&) const = default;
+    };
+    struct Chunk {
+        sf::VertexBuffer vertices { sf::PrimitiveType::Triangles, sf::VertexBuffer::Usage::Static };
+        // Tile positions are relative to this, so that they don't lose precision far into the file.
+        size_t origin_tick = 0;
+        // The geometry is up to date if this equals m_layout_version.
+        size_t layout_version = 0;
+        // Index (relative to the chunk) of the first tile that each quad in `vertices` was made of.
+        std::vector<uint32_t> first_tiles;
+    };
+    mutable std::unordered_map<size_t, Chunk> m_chunks;
+    // Tiles to draw for a chunk that is built, with indices of the first tile each was made of.
+    mutable std::vector<std::pair<size_t, Tile>> m_chunk_tiles;
+    mutable std::vector<size_t> m_drawn_chunks;
+    mutable ChunkLayout m_chunk_layout;
+    mutable size_t m_layout_version = 1;
 };
@@ -1,21 +1,12 @@
 #include "Track.h"
 
-void Track::add_event(std::unique_ptr<Event>&& event)
-{
-    m_events.insert({ event->tick(), std::move(event) });
-
-    if (m_max_events > 0 && m_events.size() > m_max_events)
-        m_events.erase(m_events.begin());
-}
+#include <algorithm>
 
-std::vector<Event*> Track::find_events_in_range(size_t start_tick, size_t end_tick) const
+void Track::add_event(Event event)
 {
-    std::vector<Event*> out;
-    for (size_t s = start_tick; s < end_tick; s++) {
-        auto range = m_events.equal_range(s);
-        std::for_each(range.first, range.second, [&](auto const& value) {
-            out.push_back(value.second.get());
-        });
-    }
-    return out;
+    // Events are almost always added in time order, so appending is the common case.
+    if (m_events.empty() || m_events.back().tick() <= event.tick())
+        m_events.push_back(event);
+    else
+        m_events.insert(std::ranges::upper_bound(m_events, event.tick(), {}, &Event::tick), event);
 }
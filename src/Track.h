@@ -2,18 +2,18 @@
 
 #include "Event.h"
 
-#include <memory>
 #include <vector>
 
+// Events of a single track chunk, as they are decoded. They are merged into an EventTimeline for playing.
 class Track {
 public:
-    void add_event(std::unique_ptr<Event>&& data);
-    std::vector<Event*> find_events_in_range(size_t start_tick, size_t end_tick) const;
-    std::multimap<size_t, std::unique_ptr<Event>> const& events() const { return m_events; }
+    void add_event(Event event);
 
-    void set_max_events(size_t max) { m_max_events = max; }
+    // Sorted by tick. Events with the same tick are kept in the order they were added.
+    std::vector<Event> const& events() const { return m_events; }
+
+    void clear() { m_events.clear(); }
 
 private:
-    std::multimap<size_t, std::unique_ptr<Event>> m_events;
-    size_t m_max_events = 0;
+    std::vector<Event> m_events;
 };
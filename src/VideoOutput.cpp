@@ -0,0 +1,186 @@
+#include "VideoOutput.h"
+
+#include "FrameReadback.h"
+#include "FrameWriter.h"
+#include "Logger.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <fmt/format.h>
+#include <spawn.h>
+#include <sstream>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+extern char** environ;
+
+// How many frames may wait for the encoder before rendering blocks.
+constexpr size_t MaxQueuedFrames = 4;
+
+std::unique_ptr<VideoOutput> VideoOutput::create(Settings const& settings, unsigned fps)
+{
+    std::unique_ptr<VideoOutput> output { new VideoOutput };
+    if (settings.encoder_output_path.empty() && isatty(STDOUT_FILENO)) {
+        logger::error("stdout is a terminal, refusing to print binary data");
+        return nullptr;
+    }
+    if (!output->m_texture.resize(settings.size)) {
+        logger::error("Failed to create {}x{} render texture", settings.size.x, settings.size.y);
+        return nullptr;
+    }
+    // The window only shows a preview of it, so make downscaling it look better.
+    output->m_texture.setSmooth(true);
+
+    // Failed writes are handled (by stopping) instead of killing the process.
+    signal(SIGPIPE, SIG_IGN);
+    if (settings.encoder_output_path.empty())
+        logger::info("Rendering to stdout (RGBA {}x{} {}fps)", settings.size.x, settings.size.y, fps);
+    else if (!output->start_encoder(settings, fps))
+        return nullptr;
+
+    output->m_readback = std::make_unique<FrameReadback>(output->m_texture);
+    output->m_writer = std::make_unique<FrameWriter>(output->m_output, output->m_readback->frame_size(), MaxQueuedFrames);
+    output->m_start_time = std::chrono::steady_clock::now();
+    return output;
+}
+
+VideoOutput::~VideoOutput()
+{
+    finish();
+}
+
+bool VideoOutput::start_encoder(Settings const& settings, unsigned fps)
+{
+    std::vector<std::string> arguments {
+        "ffmpeg", "-hide_banner", "-loglevel", "warning",
+        "-f", "rawvideo", "-pix_fmt", "rgba",
+        "-s:v", fmt::format("{}x{}", settings.size.x, settings.size.y),
+        "-r", std::to_string(fps),
+        "-i", "pipe:"
+    };
+    std::istringstream encoder_options { settings.encoder_options };
+    for (std::string option; encoder_options >> option;)
+        arguments.push_back(option);
+    // Overwriting was already confirmed by the user (see -f), ffmpeg would ask on stdin otherwise.
+    arguments.insert(arguments.end(), { "-y", settings.encoder_output_path });
+
+    std::vector<char*> argv;
+    for (auto& argument : arguments)
+        argv.push_back(argument.data());
+    argv.push_back(nullptr);
+
+    int pipe_fds[2];
+    if (pipe2(pipe_fds, O_CLOEXEC) < 0) {
+        logger::error("Failed to create pipe for encoder: {}", strerror(errno));
+        return false;
+    }
+    posix_spawn_file_actions_t file_actions;
+    posix_spawn_file_actions_init(&file_actions);
+    posix_spawn_file_actions_adddup2(&file_actions, pipe_fds[0], STDIN_FILENO);
+    // In its own process group, so that Ctrl+C in the terminal only interrupts us, and the encoder
+    // still gets the end of input and finishes the file.
+    posix_spawnattr_t attributes;
+    posix_spawnattr_init(&attributes);
+    posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETPGROUP);
+    posix_spawnattr_setpgroup(&attributes, 0);
+    int error = posix_spawnp(&m_encoder_pid, argv[0], &file_actions, &attributes, argv.data(), environ);
+    posix_spawnattr_destroy(&attributes);
+    posix_spawn_file_actions_destroy(&file_actions);
+    close(pipe_fds[0]);
+    if (error != 0) {
+        close(pipe_fds[1]);
+        m_encoder_pid = -1;
+        logger::error("Failed to start encoder ({}): {}", argv[0], strerror(error));
+        return false;
+    }
+    m_output = fdopen(pipe_fds[1], "w");
+    if (!m_output) {
+        logger::error("Failed to open pipe to encoder: {}", strerror(errno));
+        close(pipe_fds[1]);
+        kill(m_encoder_pid, SIGTERM);
+        waitpid(m_encoder_pid, nullptr, 0);
+        m_encoder_pid = -1;
+        return false;
+    }
+    logger::info("Encoding to {} ({}x{} {}fps, pid {})", settings.encoder_output_path, settings.size.x, settings.size.y, fps, m_encoder_pid);
+    return true;
+}
+
+bool VideoOutput::encoder_exited()
+{
+    if (m_encoder_pid < 0)
+        return false;
+    if (m_encoder_status)
+        return true;
+    int status;
+    if (waitpid(m_encoder_pid, &status, WNOHANG) != m_encoder_pid)
+        return false;
+    m_encoder_status = status;
+    return true;
+}
+
+void VideoOutput::write_frame()
+{
+    m_readback->start();
+    if (m_readback->pending_frames() == FrameReadback::RingSize)
+        write_oldest_frame();
+}
+
+void VideoOutput::write_oldest_frame()
+{
+    auto frame = m_writer->acquire_frame();
+    m_readback->finish(frame);
+    m_writer->submit_frame(std::move(frame));
+}
+
+bool VideoOutput::failed()
+{
+    if (encoder_exited()) {
+        logger::error("Encoder exited unexpectedly");
+        return true;
+    }
+    return m_readback->failed() || m_writer->failed();
+}
+
+bool VideoOutput::finish()
+{
+    if (m_finished || !m_writer)
+        return m_succeeded;
+    m_finished = true;
+
+    while (m_readback->pending_frames() > 0)
+        write_oldest_frame();
+    m_writer->close();
+    m_succeeded = !m_readback->failed() && !m_writer->failed();
+
+    if (m_encoder_pid >= 0) {
+        // This is the end of input for the encoder.
+        fclose(m_output);
+        int status = 0;
+        if (m_encoder_status)
+            status = *m_encoder_status;
+        else
+            waitpid(m_encoder_pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            logger::error("Encoder failed ({})", WIFEXITED(status) ? fmt::format("exit code {}", WEXITSTATUS(status)) : "killed by a signal");
+            m_succeeded = false;
+        }
+    }
+    logger::info("{}", stats_string());
+    return m_succeeded;
+}
+
+std::string VideoOutput::stats_string() const
+{
+    if (!m_writer)
+        return {};
+    auto stats = m_writer->stats();
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start_time).count();
+    return fmt::format("Video: {}x{} frames={} queued={}/{} throughput={:.1f} fps ({:.1f} MB/s) blocked={:.1f}% write={:.2f} ms/frame",
+        m_texture.getSize().x, m_texture.getSize().y, stats.frames_written, stats.queued_frames, m_writer->max_queued_frames(),
+        stats.frames_written / elapsed, stats.bytes_written / elapsed / 1e6, 100 * stats.blocked_time.count() / elapsed,
+        stats.frames_written ? stats.write_time.count() * 1000 / stats.frames_written : 0.0);
+}
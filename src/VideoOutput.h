@@ -0,0 +1,62 @@
+#pragma once
+
+#include <SFML/Graphics/RenderTexture.hpp>
+#include <SFML/System/Vector2.hpp>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <optional>
+#include <string>
+#include <sys/types.h>
+
+class FrameReadback;
+class FrameWriter;
+
+// Video rendered frame by frame (not in real time): frames are rendered to a texture of the
+// requested size, read back and written either to stdout (as raw RGBA) or to an encoder (ffmpeg)
+// process that is started and supervised here.
+class VideoOutput {
+public:
+    struct Settings {
+        sf::Vector2u size { 1920, 1080 };
+        // Empty to write raw frames to stdout.
+        std::string encoder_output_path;
+        // Passed to the encoder before the output path, split on whitespace (e.g "-c:v libx264 -crf 18").
+        std::string encoder_options;
+    };
+
+    // Returns null (and logs why) if the output couldn't be set up.
+    static std::unique_ptr<VideoOutput> create(Settings const&, unsigned fps);
+    VideoOutput(VideoOutput const&) = delete;
+    VideoOutput& operator=(VideoOutput const&) = delete;
+    ~VideoOutput();
+
+    // Frames are rendered here.
+    sf::RenderTexture& texture() { return m_texture; }
+
+    // Sends the frame that was last displayed on the texture.
+    void write_frame();
+    // Reading or writing a frame failed or the encoder exited, so no more frames can be written.
+    bool failed();
+    // Writes remaining frames and waits for the encoder to finish. Returns false if anything failed.
+    bool finish();
+
+    std::string stats_string() const;
+
+private:
+    VideoOutput() = default;
+
+    bool start_encoder(Settings const&, unsigned fps);
+    bool encoder_exited();
+    void write_oldest_frame();
+
+    sf::RenderTexture m_texture;
+    FILE* m_output = stdout;
+    pid_t m_encoder_pid = -1;
+    std::optional<int> m_encoder_status;
+    std::unique_ptr<FrameReadback> m_readback;
+    std::unique_ptr<FrameWriter> m_writer;
+    std::chrono::steady_clock::time_point m_start_time;
+    bool m_finished = false;
+    bool m_succeeded = false;
+};
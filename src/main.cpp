@@ -2,15 +2,21 @@
 #include "Logger.h"
 #include "MIDIDevice.h"
 #include "MIDIFile.h"
+#include "MIDIFileCache.h"
+#include "MIDIFileStream.h"
 #include "MIDIPlayer.h"
+#include "MappedFile.h"
 #include "Resources.h"
 
+#include <chrono>
 #include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <iterator>
+#include <sstream>
 #include <string_view>
 #include <sys/stat.h>
+#include <thread>
 
 using namespace std::literals;
 
@@ -33,13 +39,21 @@ static void print_usage_and_exit(Brief brief = Brief::Yes)
         std::cerr << "    -c [path]          Specify alternative config file" << std::endl;
         std::cerr << "    -d                 Headless mode (don't open a window, works in text mode)" << std::endl;
         std::cerr << "    -f                 Force overwriting output files" << std::endl;
+        std::cerr << "    -j [count]         Number of threads used for decoding MIDI file tracks (default: all cores)" << std::endl;
         std::cerr << "    -m [file/port]     Specify MIDI output (file in realtime mode, port number in play mode)" << std::endl;
         std::cerr << "    -o                 Print render to stdout (may be c for rendering with ffmpeg)" << std::endl;
         std::cerr << "    -r                 Remove empty MIDI file if nothing was written (only for realtime mode)" << std::endl;
         std::cerr << "    --config-help      Print help for Config Files" << std::endl;
         std::cerr << "    --debug            Enable debug info rendering" << std::endl;
+        std::cerr << "    --encode [file]    Render to a video file, encoded by ffmpeg" << std::endl;
+        std::cerr << "    --encoder-options [options]" << std::endl;
+        std::cerr << "                       Output options passed to ffmpeg when encoding (e.g. \"-c:v libx264 -crf 18\")" << std::endl;
+        std::cerr << "    --fps [count]      Frame rate of playback and rendered video (default: 60)" << std::endl;
         std::cerr << "    --help             Print this message" << std::endl;
         std::cerr << "    --markers [file]   Enable markers; save them to `file` (add them with number keys)" << std::endl;
+        std::cerr << "    --no-cache         Always parse the MIDI file instead of using/updating the cache of decoded files" << std::endl;
+        std::cerr << "    --resolution [WxH] Resolution of rendered video (default: 1920x1080)" << std::endl;
+        std::cerr << "    --stream           Decode the MIDI file during playback instead of loading it whole (for files that don't fit in memory)" << std::endl;
         std::cerr << "    --version          Print MIDIPlayer version" << std::endl;
     } else {
         std::cerr << "Use --help to print available options." << std::endl;
@@ -196,6 +210,22 @@ private:
         };
     }
 
+    static Option option_handler(std::string_view name, int& target)
+    {
+        return {
+            .handler = [name, &target](std::string_view param) -> Result {
+                try {
+                    target = std::stoi(std::string(param));
+                    return {};
+                } catch (...) {
+                    return fmt::format("Failed to parse int for option '{}'", name);
+                }
+            },
+            .name = name,
+            .is_boolean = false,
+        };
+    }
+
     static Option option_handler(std::string_view name, std::string& target)
     {
         return {
@@ -247,15 +277,27 @@ int main(int argc, char* argv[])
     bool headless = false;
     parser.option("-d", headless);
     parser.option("-f", args.force_overwrite);
+    int parse_thread_count = 0;
+    parser.option("-j", parse_thread_count);
     parser.option("-m", args.midi_output);
     parser.option("-o", args.render_to_stdout);
     parser.option("-r", args.remove_file_if_nothing_written);
     bool print_config_help = false;
     parser.option("--config-help", print_config_help);
     parser.option("--debug", args.should_render_debug_info_in_preview);
+    parser.option("--encode", args.video_output.encoder_output_path);
+    parser.option("--encoder-options", args.video_output.encoder_options);
+    int fps = 60;
+    parser.option("--fps", fps);
     bool help = false;
     parser.option("--help", help);
     parser.option("--markers", args.marker_file_name);
+    bool no_cache = false;
+    parser.option("--no-cache", no_cache);
+    std::string resolution;
+    parser.option("--resolution", resolution);
+    bool stream = false;
+    parser.option("--stream", stream);
     bool version = false;
     parser.option("--version", version);
 
@@ -274,7 +316,33 @@ int main(int argc, char* argv[])
         return 0;
     }
 
+    if (fps <= 0) {
+        logger::error("Frame rate must be positive");
+        return 1;
+    }
+    if (!resolution.empty()) {
+        unsigned width = 0, height = 0;
+        char separator = 0;
+        std::istringstream resolution_stream { resolution };
+        if (!(resolution_stream >> width >> separator >> height) || separator != 'x' || !resolution_stream.eof() || width == 0 || height == 0) {
+            logger::error("Invalid resolution '{}', expected WIDTHxHEIGHT", resolution);
+            return 1;
+        }
+        args.video_output.size = { width, height };
+    }
+    if (!args.video_output.encoder_output_path.empty()) {
+        if (args.render_to_stdout) {
+            logger::error("-o and --encode can't be used together");
+            return 1;
+        }
+        if (!args.force_overwrite && std::filesystem::exists(args.video_output.encoder_output_path)) {
+            logger::error("Output file '{}' already exists. Use -f flag to force overwrite.", args.video_output.encoder_output_path);
+            return 1;
+        }
+    }
+
     MIDIPlayer player;
+    player.set_fps(fps);
     if (headless) {
         player.set_headless();
     }
@@ -288,26 +356,58 @@ int main(int argc, char* argv[])
     }
     std::string const& mode_string = *mode_string_opt;
 
+    // Decoded MIDI files are cached so that the next run doesn't need to parse it again.
+    std::optional<MIDIFileCache> midi_file_cache;
+    bool loaded_from_cache = false;
+
     if (mode_string == "play") {
         args.mode = MIDIPlayer::Args::Mode::Play;
         if (!filename) {
             logger::error("Input filename required for play mode");
             return 1;
         }
-        std::ifstream stream(std::string { *filename }, std::ios::binary);
-        if (stream.fail()) {
-            logger::error("Failed to open file");
+        auto mapped_file = MappedFile::map(std::string { *filename });
+        if (mapped_file.is_error()) {
+            logger::error("Failed to open file: {}", mapped_file.release_error());
             return 1;
         }
-        auto midi_file = std::make_unique<MIDIFileInput>(stream);
-        if (!midi_file->is_valid()) {
-            logger::error("Failed to read MIDI");
-            return 1;
+        if (parse_thread_count <= 0)
+            parse_thread_count = std::max(1u, std::thread::hardware_concurrency());
+        auto parse_start = std::chrono::steady_clock::now();
+        std::unique_ptr<MIDIFileInput> midi_file;
+        if (stream) {
+            // Streamed files are never fully decoded, so there is nothing to cache.
+            auto file_size = mapped_file.value().size();
+            midi_file = std::make_unique<MIDIFileStreamInput>(mapped_file.release_value(), parse_thread_count);
+            if (!midi_file->is_valid()) {
+                logger::error("Failed to read MIDI");
+                return 1;
+            }
+            auto scan_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - parse_start).count();
+            logger::info("Scanned {} bytes in {:.3f}s, streaming", file_size, scan_time);
+        } else if (!no_cache) {
+            midi_file_cache.emplace(mapped_file.value().data());
+            if (auto contents = midi_file_cache->load()) {
+                midi_file = std::move(contents->input);
+                player.tile_world().set_tiles(std::move(contents->tiles));
+                loaded_from_cache = true;
+            }
+        }
+        if (loaded_from_cache) {
+            auto load_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - parse_start).count();
+            logger::info("Loaded from cache {} in {:.3f}s", midi_file_cache->path(), load_time);
+        } else if (!stream) {
+            midi_file = std::make_unique<MIDIFileInput>(mapped_file.value().data(), parse_thread_count);
+            if (!midi_file->is_valid()) {
+                logger::error("Failed to read MIDI");
+                return 1;
+            }
+            auto parse_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - parse_start).count();
+            logger::info("Parsed {} bytes in {:.3f}s ({:.1f} MB/s, {} threads)", mapped_file.value().size(), parse_time,
+                mapped_file.value().size() / parse_time / 1e6, parse_thread_count);
         }
 
-        midi_file->for_each_track([&player](auto const& track) {
-            player.did_read_events(track.events().size());
-        });
+        player.did_read_events(midi_file->timeline().size());
 
         int value = 0;
         if (!args.midi_output.empty()) {
@@ -353,6 +453,12 @@ int main(int argc, char* argv[])
     }
     player.setup();
 
+    // Tiles are laid out in setup(), so the cache can be written only now.
+    if (midi_file_cache && !loaded_from_cache) {
+        if (midi_file_cache->store(static_cast<MIDIFileInput const&>(*player.midi_input()), player.tile_world()))
+            logger::info("Saved decoded MIDI file to cache {}", midi_file_cache->path());
+    }
+
     if (args.config_file_path.empty())
         player.load_config_file("config.cfg");
     else if (!player.load_config_file(args.config_file_path)) {
@@ -361,7 +467,7 @@ int main(int argc, char* argv[])
     }
     player.run(args);
 
-    if (args.remove_file_if_nothing_written && player.real_time() && !args.midi_output.empty() && player.midi_input()->track(0).events().empty()) {
+    if (args.remove_file_if_nothing_written && player.real_time() && !args.midi_output.empty() && player.midi_input()->timeline().empty()) {
         logger::info("No events recorded, removing empty file.");
         std::filesystem::remove(args.midi_output);
     }